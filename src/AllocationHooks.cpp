@@ -0,0 +1,120 @@
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "Allocations.h"
+
+/* The global operator new and delete that feed Allocations.cpp. This is the
+ * only file in libtestframework_allocs.a, and it's kept out of
+ * libtestframework.a so that replacing the allocator is the test binary's
+ * choice:
+ *
+ *     g++ -std=c++17 FooTest.cpp libtestframework.a \
+ *         libtestframework_allocs.a -pthread
+ *
+ * Every block starts with a Header, which says which run (if any) to credit
+ * when it's freed.
+ */
+
+namespace alloc {
+
+// Allocations.cpp checks for this to tell whether the hooks are linked in
+bool hooksLinked_() {
+    return true;
+}
+
+namespace {
+
+struct alignas(16) Header {
+    uint64_t size;
+    uint32_t slot;
+    uint32_t generation;
+};
+
+static_assert(sizeof(Header) == 16, "keeps the caller's block 16 aligned");
+
+void* allocate(size_t size) {
+    Header* header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+    if (!header) {
+        return nullptr;
+    }
+    header->size = size;
+    header->generation = 0;
+    header->slot = charge_(size, header->generation);
+    return header + 1;
+}
+
+void* allocateOrThrow(size_t size) {
+    while (true) {
+        void* block = allocate(size);
+        if (block) {
+            return block;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void release(void* block) {
+    if (!block) {
+        return;
+    }
+    Header* header = static_cast<Header*>(block) - 1;
+    credit_(header->slot, header->generation, header->size);
+    std::free(header);
+}
+
+} // namespace
+
+} // namespace alloc
+
+void* operator new(size_t size) {
+    return alloc::allocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+    return alloc::allocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return alloc::allocateOrThrow(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return alloc::allocateOrThrow(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* block) noexcept {
+    alloc::release(block);
+}
+
+void operator delete[](void* block) noexcept {
+    alloc::release(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    alloc::release(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+    alloc::release(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+    alloc::release(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+    alloc::release(block);
+}
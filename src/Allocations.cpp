@@ -0,0 +1,171 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include "Allocations.h"
+
+/* The accounting behind Allocations.h. The global operator new and delete
+ * that feed it are in AllocationHooks.cpp, which is only linked into test
+ * binaries that ask for it (libtestframework_allocs.a), so the core library
+ * never replaces anyone's allocator.
+ *
+ * A run is a slot in a fixed table, so a block can refer to it after the run
+ * is over: the slot's generation changes when the run ends, and frees that
+ * come later don't match it.
+ */
+
+namespace alloc {
+
+namespace {
+
+struct Slot {
+    std::atomic<bool> inUse{false};
+    std::atomic<uint32_t> generation{0};
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> liveBytes{0};
+    std::atomic<size_t> peakBytes{0};
+};
+
+// More runs than this at once (workers times --concurrency) go uncounted
+constexpr uint32_t numSlots = 4096;
+constexpr uint32_t noSlot = UINT32_MAX;
+
+Slot slots[numSlots];
+std::atomic<uint32_t> nextSlot{0};
+
+// Plain thread_locals with constant initializers, so reading them from
+// operator new never needs a guard or an allocation of its own
+thread_local uint32_t currentSlot = noSlot;
+thread_local bool paused = false;
+thread_local size_t threadAllocationCount = 0;
+thread_local size_t threadByteCount = 0;
+
+uint32_t acquireSlot() {
+    for (uint32_t tries = 0; tries < numSlots; ++tries) {
+        uint32_t index = nextSlot.fetch_add(1, std::memory_order_relaxed)
+            % numSlots;
+        bool expected = false;
+        if (slots[index].inUse.compare_exchange_strong(expected, true)) {
+            Slot& slot = slots[index];
+            slot.allocations.store(0, std::memory_order_relaxed);
+            slot.bytes.store(0, std::memory_order_relaxed);
+            slot.liveBytes.store(0, std::memory_order_relaxed);
+            slot.peakBytes.store(0, std::memory_order_relaxed);
+            return index;
+        }
+    }
+    return noSlot;
+}
+
+Stats statsOf(uint32_t index) {
+    Stats stats;
+    if (index == noSlot) {
+        return stats;
+    }
+    const Slot& slot = slots[index];
+    stats.allocations = slot.allocations.load(std::memory_order_relaxed);
+    stats.bytes = slot.bytes.load(std::memory_order_relaxed);
+    stats.peakBytes = slot.peakBytes.load(std::memory_order_relaxed);
+    stats.liveBytes = slot.liveBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace
+
+bool tracking() {
+    return hooksLinked_ != nullptr;
+}
+
+uint32_t charge_(size_t size, uint32_t& generation) {
+    ++threadAllocationCount;
+    threadByteCount += size;
+    const uint32_t index = currentSlot;
+    if (index == noSlot || paused) {
+        return noSlot;
+    }
+    Slot& slot = slots[index];
+    generation = slot.generation.load(std::memory_order_relaxed);
+    slot.allocations.fetch_add(1, std::memory_order_relaxed);
+    slot.bytes.fetch_add(size, std::memory_order_relaxed);
+    size_t live = slot.liveBytes.fetch_add(size, std::memory_order_relaxed)
+        + size;
+    size_t peak = slot.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !slot.peakBytes.compare_exchange_weak(
+                peak, live, std::memory_order_relaxed)) {
+    }
+    return index;
+}
+
+void credit_(uint32_t index, uint32_t generation, size_t size) {
+    if (index == noSlot) {
+        return;
+    }
+    // A run that's already over has moved on to a new generation. (If the
+    // slot was reused in between, this can credit the wrong run, which takes
+    // 2^32 runs on that slot.)
+    Slot& slot = slots[index];
+    if (slot.generation.load(std::memory_order_relaxed) == generation) {
+        slot.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+}
+
+size_t threadAllocations() {
+    return threadAllocationCount;
+}
+
+size_t threadBytes() {
+    return threadByteCount;
+}
+
+Stats current() {
+    return statsOf(currentSlot);
+}
+
+Scope::Scope() : slot_(acquireSlot()), previous_(currentSlot) {
+    currentSlot = slot_;
+}
+
+Scope::~Scope() {
+    currentSlot = previous_;
+    if (slot_ != noSlot) {
+        slots[slot_].generation.fetch_add(1, std::memory_order_relaxed);
+        slots[slot_].inUse.store(false, std::memory_order_release);
+    }
+}
+
+Stats Scope::stats() const {
+    return statsOf(slot_);
+}
+
+Pause::Pause() : previous_(paused) {
+    paused = true;
+}
+
+Pause::~Pause() {
+    paused = previous_;
+}
+
+void requireTracking_(const char* file, int line) {
+    if (!tracking()) {
+        throw assert::assertion_error(assert::location_(file, line)
+                + "ASSERT_MAX_ALLOCS needs the allocation hooks. Link "
+                "libtestframework_allocs.a after libtestframework.a.");
+    }
+}
+
+void failMaxAllocs_(
+        const char* file, int line, const char* expression,
+        size_t budget, size_t allocations, size_t bytes) {
+    Pause pause;
+    std::string message = assert::location_(file, line)
+        + "Failed asserting that "
+        + (expression ? expression : std::string("the test"))
+        + " makes at most " + std::to_string(budget) + " allocations."
+        + "\n    It made " + std::to_string(allocations) + " ("
+        + std::to_string(bytes) + " bytes).";
+    throw assert::assertion_error(message);
+}
+
+} // namespace alloc
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Assert.h"
+
+/* Allocation accounting. Linking libtestframework_allocs.a after
+ * libtestframework.a replaces the global operator new and delete, and every
+ * allocation made on a thread that's running a test is charged to that
+ * test's run, wherever it ends up being freed. Passing --allocs prints the
+ * totals for each test, and any bytes the test left allocated when it
+ * finished as a leak.
+ *
+ * Without that library nothing is counted: --allocs is an error, and so is
+ * every ASSERT_MAX_ALLOCS. With it, the counts are kept whether or not
+ * --allocs is given, so budgets work in every run:
+ *
+ *     TEST("LookupDoesNotAllocate") {
+ *         Table table = makeTable();
+ *         ASSERT_MAX_ALLOCS(0, table.find("key"));
+ *         ASSERT_MAX_ALLOCS(10);  // for the whole test so far
+ *     }
+ *
+ * Only plain and array new are tracked; over-aligned new (alignas above 16)
+ * goes straight to the standard library.
+ */
+namespace alloc {
+
+struct Stats {
+    size_t allocations = 0;
+    size_t bytes = 0;
+    // Most bytes the run had allocated at once
+    size_t peakBytes = 0;
+    // Still allocated; at the end of a run, that's leaked
+    size_t liveBytes = 0;
+};
+
+// Whether libtestframework_allocs.a is linked in, so anything is counted
+bool tracking();
+
+// Allocations made on the calling thread since it started, test or not
+size_t threadAllocations();
+size_t threadBytes();
+
+// Totals for the run on the calling thread so far. Zeroes outside a test.
+Stats current();
+
+/* Charges allocations on this thread to a new run until destroyed. The runner
+ * opens one around every test run.
+ */
+class Scope {
+  public:
+    Scope();
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    Stats stats() const;
+
+  private:
+    unsigned slot_;
+    unsigned previous_;
+};
+
+/* Allocations made on this thread while one of these exists aren't charged
+ * to the test, e.g. the framework's own bookkeeping and captured output.
+ */
+class Pause {
+  public:
+    Pause();
+    ~Pause();
+    Pause(const Pause&) = delete;
+    Pause& operator=(const Pause&) = delete;
+
+  private:
+    bool previous_;
+};
+
+// Defined only in libtestframework_allocs.a
+__attribute__((weak)) bool hooksLinked_();
+
+// Called by those hooks for each block. charge_ returns the slot the block
+// was charged to, which credit_ is given back when it's freed.
+uint32_t charge_(size_t size, uint32_t& generation);
+void credit_(uint32_t slot, uint32_t generation, size_t size);
+
+void requireTracking_(const char* file, int line);
+
+[[noreturn]] void failMaxAllocs_(
+        const char* file, int line, const char* expression,
+        size_t budget, size_t allocations, size_t bytes);
+
+} // namespace alloc
+
+#define ASSERT_MAX_ALLOCS1(budget) \
+    do { \
+        alloc::requireTracking_(__FILE__, __LINE__); \
+        alloc::Stats assertAllocs_ = alloc::current(); \
+        if (assertAllocs_.allocations > static_cast<size_t>(budget)) { \
+            alloc::failMaxAllocs_(__FILE__, __LINE__, nullptr, (budget), \
+                    assertAllocs_.allocations, assertAllocs_.bytes); \
+        } \
+    } while (0)
+
+// The expression is evaluated once, on this thread, and its result dropped
+#define ASSERT_MAX_ALLOCS2(budget, expression) \
+    do { \
+        alloc::requireTracking_(__FILE__, __LINE__); \
+        size_t assertAllocsBefore_ = alloc::threadAllocations(); \
+        size_t assertBytesBefore_ = alloc::threadBytes(); \
+        (void)(expression); \
+        size_t assertAllocs_ = \
+            alloc::threadAllocations() - assertAllocsBefore_; \
+        if (assertAllocs_ > static_cast<size_t>(budget)) { \
+            alloc::failMaxAllocs_(__FILE__, __LINE__, #expression, (budget), \
+                    assertAllocs_, \
+                    alloc::threadBytes() - assertBytesBefore_); \
+        } \
+    } while (0)
+
+#define ASSERT_MAX_ALLOCS(...) GET_MACRO_1_2( \
+        __VA_ARGS__, ASSERT_MAX_ALLOCS2, ASSERT_MAX_ALLOCS1)(__VA_ARGS__)
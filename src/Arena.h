@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/* Scratch memory for one test. Allocating is a pointer bump, freeing does
+ * nothing, and when the test finishes the runner rewinds the arena so the
+ * next test on the same thread reuses the same blocks. After the first few
+ * tests, scratch data costs no calls to malloc at all.
+ *
+ *     TEST("Parses") {
+ *         std::vector<Token, test::ArenaAllocator<Token>> tokens(test::arena());
+ *         int* counts = test::arena().make<int>(256);
+ *         ...
+ *     }
+ *
+ * Nothing allocated here has its destructor run by the arena, so anything
+ * that owns other resources should be destroyed by the test as usual (which
+ * containers using ArenaAllocator are, when they go out of scope).
+ */
+namespace test {
+
+class Arena {
+  public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        while (first_) {
+            Block* next = first_->next;
+            std::free(first_);
+            first_ = next;
+        }
+    }
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        uintptr_t start = (current_ + align - 1) & ~uintptr_t(align - 1);
+        if (start + size > end_) {
+            return allocateSlow(size, align);
+        }
+        current_ = start + size;
+        used_ += size;
+        return reinterpret_cast<void*>(start);
+    }
+
+    // count default constructed Ts
+    template <typename T>
+    T* make(size_t count = 1) {
+        T* items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; ++i) {
+            new (items + i) T();
+        }
+        return items;
+    }
+
+    // Bytes handed out since the last reset
+    size_t used() const {
+        return used_;
+    }
+
+    // Makes all memory available again without giving any of it back
+    void reset() {
+        used_ = 0;
+        if (first_) {
+            enter(first_);
+        }
+    }
+
+  private:
+    // Blocks come straight from malloc, so they're never counted as
+    // allocations made by the test (see Allocations.h)
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    static constexpr size_t minBlockSize = 64 * 1024;
+
+    void* allocateSlow(size_t size, size_t align) {
+        // Move on to the next block that's big enough, making one if needed
+        while (true) {
+            Block* next = block_ ? block_->next : first_;
+            if (!next) {
+                // Doubling, so a test that needs a lot only grows it a few
+                // times
+                size_t blockSize = block_ ? block_->size * 2 : minBlockSize;
+                if (blockSize < sizeof(Block) + size + align) {
+                    blockSize = sizeof(Block) + size + align;
+                }
+                next = static_cast<Block*>(std::malloc(blockSize));
+                if (!next) {
+                    throw std::bad_alloc();
+                }
+                next->next = nullptr;
+                next->size = blockSize;
+                (block_ ? block_->next : first_) = next;
+            }
+            enter(next);
+            uintptr_t start = (current_ + align - 1) & ~uintptr_t(align - 1);
+            if (start + size <= end_) {
+                current_ = start + size;
+                used_ += size;
+                return reinterpret_cast<void*>(start);
+            }
+        }
+    }
+
+    void enter(Block* block) {
+        block_ = block;
+        current_ = reinterpret_cast<uintptr_t>(block + 1);
+        end_ = reinterpret_cast<uintptr_t>(block) + block->size;
+    }
+
+    Block* first_ = nullptr;
+    Block* block_ = nullptr;
+    uintptr_t current_ = 0;
+    uintptr_t end_ = 0;
+    size_t used_ = 0;
+};
+
+// The calling thread's arena. Each worker thread has its own.
+Arena& arena();
+
+// For standard containers, e.g. std::vector<int, test::ArenaAllocator<int>>
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator(Arena& arena) : arena_(&arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {
+    }
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena_->allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena_ != other.arena_;
+    }
+
+    Arena* arena_;
+};
+
+} // namespace test
@@ -1,5 +1,30 @@
-#include <string>
+#pragma once
+
+#include <cstring>
+#include <ostream>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/* The ASSERT_* macros check their condition inline and only call into this
+ * namespace once it has failed. A passing assertion evaluates its operands
+ * once, compares them, and does nothing else: no allocation, no formatting,
+ * and the optional message argument isn't even evaluated. Everything that
+ * builds strings lives in the fail*_ functions, which are kept out of line
+ * and marked cold so they don't bloat the loops that call them. The ones
+ * that aren't templates are compiled once, in TestFramework.cpp.
+ *
+ * EXPECT_* take the same arguments but don't stop the test. A failure is
+ * recorded in a collector for the calling thread and the test carries on;
+ * the runner fails the test afterwards with every failure it recorded. Only
+ * the first ten messages are built and kept, after that failures are just
+ * counted, so a check that fails in a hot loop stays cheap. Failures
+ * recorded on threads the test starts itself aren't seen by the runner.
+ */
+
+#define ASSERT_COLD_ __attribute__((noinline, cold))
 
 namespace assert {
 
@@ -9,36 +34,123 @@ class assertion_error : public std::runtime_error {
         : std::runtime_error(message) {}
 };
 
-void assert_(bool condition, std::string message, std::string customMessage="") {
+std::string withDetail_(
+        const std::string& message, const std::string& customMessage);
+
+inline void assert_(
+        bool condition,
+        const std::string& message,
+        const std::string& customMessage="") {
     if (!condition) {
-        if (customMessage.empty()) {
-            throw assertion_error(message);
-        }
+        throw assertion_error(withDetail_(message, customMessage));
+    }
+}
+
+template <typename T, typename = void>
+struct isPrintable : std::false_type {};
 
-        throw assertion_error(
-                message + std::string("\n    Test detail: ") + customMessage);
+template <typename T>
+struct isPrintable<T, std::void_t<decltype(
+        std::declval<std::ostream&>() << std::declval<const T&>())>>
+    : std::true_type {};
+
+template <typename T>
+constexpr bool isCString =
+    std::is_same_v<std::decay_t<T>, const char*>
+    || std::is_same_v<std::decay_t<T>, char*>;
+
+// C strings are compared by contents, everything else with ==. Two null
+// C strings are equal, a null one isn't equal to any string.
+template <typename A, typename B>
+bool equal_(A& a, B& b) {
+    if constexpr (isCString<A> && isCString<B>) {
+        // A literal comes in as an array, which can't be compared as is
+        const char* aString = a;
+        const char* bString = b;
+        if (aString == nullptr || bString == nullptr) {
+            return aString == bString;
+        }
+        return std::strcmp(aString, bString) == 0;
+    } else {
+        return a == b;
     }
 }
 
-void assertTrue_(bool condition, std::string customMessage="") {
-    assert_(condition, std::string("Failed asserting that ")
-            + std::to_string(condition)
-            + std::string(" is True."), customMessage);
+// What a failed ASSERT_EQ prints for a value. A null C string would be
+// undefined behaviour to stream, so it's shown as (null).
+template <typename T>
+const T& printable_(const T& value) {
+    return value;
 }
 
-void assertFalse_(bool condition, std::string customMessage="") {
-    assert_(!condition, std::string("Failed asserting that ")
-            + std::to_string(condition)
-            + std::string(" is False."), customMessage);
+inline const char* printable_(const char* value) {
+    return value ? value : "(null)";
 }
 
-template <typename T>
-// TODO: Figure out a good way to print the printable values without throwing
-// on the non-printable values
-void assertEqual_(T val1, T val2, std::string customMessage="") {
-    assert_(val1 == val2,
-            std::string("Failed asserting that two values are equal."),
-            customMessage);
+inline const char* printable_(char* value) {
+    return value ? value : "(null)";
+}
+
+// "tests/AssertTest.cpp", 12 -> "AssertTest.cpp:12: "
+std::string location_(const char* file, int line);
+
+template <typename A, typename B>
+ASSERT_COLD_ std::string equalMessage_(
+        const char* file, int line,
+        const char* lhsExpression, const char* rhsExpression,
+        const A& lhs, const B& rhs) {
+    std::ostringstream message;
+    message << location_(file, line) << "Failed asserting that "
+        << lhsExpression << " == " << rhsExpression << ".";
+    if constexpr (isPrintable<A>::value && isPrintable<B>::value) {
+        message << "\n    Left:  " << printable_(lhs)
+            << "\n    Right: " << printable_(rhs);
+    }
+    return message.str();
+}
+
+[[noreturn]] ASSERT_COLD_ void failTrue_(
+        const char* file, int line, const char* expression, bool expected,
+        const std::string& customMessage);
+
+// Counts an EXPECT_* failure on this thread. True if its message should
+// still be built and passed to expectFailed_.
+ASSERT_COLD_ bool countExpectFailure_();
+
+ASSERT_COLD_ void expectFailed_(std::string message);
+
+ASSERT_COLD_ void expectTrueFailed_(
+        const char* file, int line, const char* expression, bool expected,
+        const std::string& customMessage);
+
+/* Everything EXPECT_* recorded on this thread since the last call, one
+ * failure after another in the format the console prints them in, and
+ * empties the collector. Empty if nothing failed.
+ */
+std::string takeExpectFailures_();
+
+template <typename A, typename B>
+[[noreturn]] ASSERT_COLD_ void failEqual_(
+        const char* file, int line,
+        const char* lhsExpression, const char* rhsExpression,
+        const A& lhs, const B& rhs,
+        const std::string& customMessage) {
+    throw assertion_error(withDetail_(
+            equalMessage_(file, line, lhsExpression, rhsExpression, lhs, rhs),
+            customMessage));
+}
+
+template <typename A, typename B>
+ASSERT_COLD_ void expectEqualFailed_(
+        const char* file, int line,
+        const char* lhsExpression, const char* rhsExpression,
+        const A& lhs, const B& rhs,
+        const std::string& customMessage) {
+    if (countExpectFailure_()) {
+        expectFailed_(withDetail_(
+                equalMessage_(file, line, lhsExpression, rhsExpression, lhs, rhs),
+                customMessage));
+    }
 }
 
 } // namespace assert
@@ -46,15 +158,63 @@ void assertEqual_(T val1, T val2, std::string customMessage="") {
 // Macro magic (see https://stackoverflow.com/questions/11761703/overloading-macro-on-number-of-arguments)
 #define GET_MACRO_1_2(_1,_2,NAME,...) NAME
 
-#define ASSERT_TRUE1(condition) assert::assertTrue_(condition)
-#define ASSERT_TRUE2(condition, message) assert::assertTrue_(condition, message)
+#define ASSERT_BOOL_(condition, expected, message) \
+    do { \
+        if (static_cast<bool>(condition) != expected) { \
+            assert::failTrue_(__FILE__, __LINE__, #condition, expected, message); \
+        } \
+    } while (0)
+
+#define ASSERT_TRUE1(condition) ASSERT_BOOL_(condition, true, "")
+#define ASSERT_TRUE2(condition, message) ASSERT_BOOL_(condition, true, message)
 #define ASSERT_TRUE(...) GET_MACRO_1_2(__VA_ARGS__, ASSERT_TRUE2, ASSERT_TRUE1)(__VA_ARGS__)
 
-#define ASSERT_FALSE1(condition) assert::assertFalse_(condition)
-#define ASSERT_FALSE2(condition, message) assert::assertFalse_(condition, message)
+#define ASSERT_FALSE1(condition) ASSERT_BOOL_(condition, false, "")
+#define ASSERT_FALSE2(condition, message) ASSERT_BOOL_(condition, false, message)
 #define ASSERT_FALSE(...) GET_MACRO_1_2(__VA_ARGS__, ASSERT_FALSE2, ASSERT_FALSE1)(__VA_ARGS__)
 
+// Each operand is evaluated exactly once, and kept by reference so it can be
+// printed if the comparison fails
+#define ASSERT_EQUAL_(param1, param2, message) \
+    do { \
+        auto&& assertLhs_ = (param1); \
+        auto&& assertRhs_ = (param2); \
+        if (!assert::equal_(assertLhs_, assertRhs_)) { \
+            assert::failEqual_(__FILE__, __LINE__, #param1, #param2, \
+                    assertLhs_, assertRhs_, message); \
+        } \
+    } while (0)
+
 #define GET_MACRO_2_3(_1,_2,_3,NAME,...) NAME
-#define ASSERT_EQ2(param1, param2) assert::assertEqual_(param1, param2)
-#define ASSERT_EQ3(param1, param2, message) assert::assertEqual_(param1, param2, message)
+#define ASSERT_EQ2(param1, param2) ASSERT_EQUAL_(param1, param2, "")
+#define ASSERT_EQ3(param1, param2, message) ASSERT_EQUAL_(param1, param2, message)
 #define ASSERT_EQ(...) GET_MACRO_2_3(__VA_ARGS__, ASSERT_EQ3, ASSERT_EQ2)(__VA_ARGS__)
+
+#define EXPECT_BOOL_(condition, expected, message) \
+    do { \
+        if (static_cast<bool>(condition) != expected) { \
+            assert::expectTrueFailed_(__FILE__, __LINE__, #condition, expected, message); \
+        } \
+    } while (0)
+
+#define EXPECT_TRUE1(condition) EXPECT_BOOL_(condition, true, "")
+#define EXPECT_TRUE2(condition, message) EXPECT_BOOL_(condition, true, message)
+#define EXPECT_TRUE(...) GET_MACRO_1_2(__VA_ARGS__, EXPECT_TRUE2, EXPECT_TRUE1)(__VA_ARGS__)
+
+#define EXPECT_FALSE1(condition) EXPECT_BOOL_(condition, false, "")
+#define EXPECT_FALSE2(condition, message) EXPECT_BOOL_(condition, false, message)
+#define EXPECT_FALSE(...) GET_MACRO_1_2(__VA_ARGS__, EXPECT_FALSE2, EXPECT_FALSE1)(__VA_ARGS__)
+
+#define EXPECT_EQUAL_(param1, param2, message) \
+    do { \
+        auto&& assertLhs_ = (param1); \
+        auto&& assertRhs_ = (param2); \
+        if (!assert::equal_(assertLhs_, assertRhs_)) { \
+            assert::expectEqualFailed_(__FILE__, __LINE__, #param1, #param2, \
+                    assertLhs_, assertRhs_, message); \
+        } \
+    } while (0)
+
+#define EXPECT_EQ2(param1, param2) EXPECT_EQUAL_(param1, param2, "")
+#define EXPECT_EQ3(param1, param2, message) EXPECT_EQUAL_(param1, param2, message)
+#define EXPECT_EQ(...) GET_MACRO_2_3(__VA_ARGS__, EXPECT_EQ3, EXPECT_EQ2)(__VA_ARGS__)
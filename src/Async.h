@@ -0,0 +1,260 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <string>
+
+#include "Assert.h"
+#include "TestRegistry.h"
+
+/* Async tests. The body of a TEST_ASYNC is a coroutine, and instead of
+ * blocking it co_awaits a timer or a file descriptor:
+ *
+ *     TEST_ASYNC("EchoesBack") {
+ *         Socket socket = connectToServer();
+ *         co_await test::writable(socket.fd());
+ *         socket.send("ping");
+ *         co_await test::readable(socket.fd());
+ *         ASSERT_EQ(socket.receive(), "ping");
+ *     }
+ *
+ * Async tests don't get a worker thread each. Once the ordinary tests are
+ * done, the runner starts every async test at once on a few event loop
+ * threads (epoll and a timer queue), so thousands of tests that mostly wait
+ * share a handful of threads. Output capture, EXPECT_* and timeouts work as
+ * for any other test. A test that runs past its timeout is destroyed where
+ * it's suspended, so no thread is left behind, but a test that blocks
+ * without co_await holds up every test on its loop. Async tests always run
+ * in-process and once, whatever --isolate and --repeat say, and their
+ * allocations aren't tracked.
+ *
+ * Coroutines that a test co_awaits have to return test::Async too.
+ *
+ * TEST_ASYNC needs C++20 (-std=c++20). The rest of the framework, and the
+ * library itself, stay C++17; the event loop only ever sees coroutines as
+ * opaque pointers plus a function to resume them.
+ */
+namespace eventloop {
+
+typedef void (*CoroutineFunc)(void* coroutine);
+
+// What the loop calls into the coroutine with
+struct Coroutine {
+    void* address = nullptr;
+    CoroutineFunc resume = nullptr;
+    CoroutineFunc destroy = nullptr;
+};
+
+// Each suspends the coroutine that's running on this thread's loop until
+// the time has passed or the file descriptor is ready
+void sleep_(double ms, Coroutine coroutine);
+void waitFd_(int fd, bool forWriting, Coroutine coroutine);
+
+// Called once by the outermost coroutine of a TEST_ASYNC as it finishes.
+// Failure is empty if it passed.
+void finish_(const std::string& failure);
+
+} // namespace eventloop
+
+namespace test {
+namespace detail {
+
+// The annotation TEST_ASYNC adds
+struct asyncBody {
+    explicit asyncBody(asyncFunc start) : start_(start) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.startAsync = start_;
+    }
+
+  private:
+    asyncFunc start_;
+};
+
+} // namespace detail
+} // namespace test
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+namespace test {
+
+class Async {
+  public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        Async get_return_object() {
+            return Async(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        // Goes back to whoever co_awaited this, or reports the test if
+        // nothing did
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(Handle self) noexcept {
+                    promise_type& promise = self.promise();
+                    if (promise.continuation) {
+                        return promise.continuation;
+                    }
+                    eventloop::finish_(describe(promise.exception));
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {
+                }
+            };
+            return Final{};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+    };
+
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    Async(Async&& other) noexcept : handle_(other.handle_) {
+        other.handle_ = nullptr;
+    }
+
+    Async(const Async&) = delete;
+    Async& operator=(const Async&) = delete;
+
+    ~Async() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // co_await on another test::Async runs it to the end and rethrows
+    // whatever it threw
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+
+    void await_resume() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception(handle_.promise().exception);
+        }
+    }
+
+    // Hands the outermost coroutine of a test over to the event loop, which
+    // destroys it once it's finished or timed out
+    eventloop::Coroutine release() {
+        eventloop::Coroutine coroutine = wrap(handle_);
+        coroutine.destroy = [](void* address) {
+            std::coroutine_handle<>::from_address(address).destroy();
+        };
+        handle_ = nullptr;
+        return coroutine;
+    }
+
+    static eventloop::Coroutine wrap(std::coroutine_handle<> handle) {
+        eventloop::Coroutine coroutine;
+        coroutine.address = handle.address();
+        coroutine.resume = [](void* address) {
+            std::coroutine_handle<>::from_address(address).resume();
+        };
+        return coroutine;
+    }
+
+  private:
+    explicit Async(Handle handle) : handle_(handle) {
+    }
+
+    // Formats a failure the way the runner does for ordinary tests
+    static std::string describe(std::exception_ptr exception) {
+        if (!exception) {
+            return "";
+        }
+        try {
+            std::rethrow_exception(exception);
+        } catch (assert::assertion_error& e) {
+            return e.what();
+        } catch (std::exception& e) {
+            return std::string("failed with exception: ") + e.what();
+        } catch (...) {
+            return "failed with an unknown exception";
+        }
+    }
+
+    Handle handle_;
+};
+
+namespace detail {
+
+struct Sleep {
+    double ms;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const {
+        eventloop::sleep_(ms, Async::wrap(handle));
+    }
+
+    void await_resume() const noexcept {
+    }
+};
+
+struct WaitFd {
+    int fd;
+    bool forWriting;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const {
+        eventloop::waitFd_(fd, forWriting, Async::wrap(handle));
+    }
+
+    void await_resume() const noexcept {
+    }
+};
+
+} // namespace detail
+
+template <typename Rep, typename Period>
+detail::Sleep sleep(std::chrono::duration<Rep, Period> duration) {
+    return detail::Sleep{
+        std::chrono::duration<double, std::milli>(duration).count()};
+}
+
+// Lets the other tests on this loop run before carrying on
+inline detail::Sleep yield() {
+    return detail::Sleep{0};
+}
+
+inline detail::WaitFd readable(int fd) {
+    return detail::WaitFd{fd, false};
+}
+
+inline detail::WaitFd writable(int fd) {
+    return detail::WaitFd{fd, true};
+}
+
+} // namespace test
+
+#endif // __cpp_impl_coroutine
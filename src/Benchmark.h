@@ -0,0 +1,24 @@
+#pragma once
+
+// The part of benchmarking that BENCHMARK bodies use. The runner that times
+// them is in BenchmarkRunner.h.
+namespace bench {
+
+/* Keeps the compiler from deleting a computation whose result is never used:
+ * as far as the optimizer knows, value is read by the empty asm statement.
+ *
+ *     BENCHMARK("Hash") {
+ *         bench::DoNotOptimize(hash(input));
+ *     }
+ */
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Forces pending writes to memory to actually happen before this point
+inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+} // namespace bench
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Assert.h"
+#include "Benchmark.h"
+#include "PerfCounters.h"
+#include "PrintHelpers.h"
+#include "TestPrinter.h"
+#include "TestRegistry.h"
+
+namespace bench {
+
+struct Settings {
+    // Wall clock each sample should take. Iterations per sample are picked
+    // to hit this.
+    double sampleMs = 50;
+    size_t numSamples = 10;
+    // Count the timed samples with perf::ThreadCounters (--perf)
+    bool perf = false;
+    bool perfHardware = true;
+};
+
+struct Stats {
+    std::string name;
+    bool failed = false;
+    std::string failure;
+    size_t iterations = 0;
+    // Nanoseconds per iteration of each sample
+    std::vector<double> samples;
+    double mean = 0;
+    double median = 0;
+    double stddev = 0;
+    double min = 0;
+    // Over every timed sample, with Settings::perf
+    perf::Counts counters;
+};
+
+/* Runs each BENCHMARK body in a loop, one benchmark at a time on the calling
+ * thread, so measurements never overlap with tests or each other.
+ *
+ * The iteration count is calibrated by growing it until one batch takes
+ * about Settings::sampleMs. After one batch of warmup, numSamples batches
+ * are timed and summarized per iteration. The body is called through a
+ * function pointer, so every iteration includes the cost of one indirect
+ * call (about a nanosecond).
+ */
+class BenchmarkRunner {
+  public:
+    explicit BenchmarkRunner(Settings settings) : settings_(settings) {
+    }
+
+    // Returns the number of benchmarks that failed
+    size_t run(const Tests& benchmarks, const std::string& outPath) {
+        std::cout << "Running " << benchmarks.size() << " benchmarks:"
+            << std::endl;
+        std::vector<Stats> results;
+        size_t numFailed = 0;
+        for (const auto& benchmark : benchmarks) {
+            results.push_back(measure(benchmark));
+            printStats(results.back());
+            numFailed += results.back().failed;
+        }
+
+        if (!outPath.empty()) {
+            writeJson(results, outPath);
+        }
+        return numFailed;
+    }
+
+  private:
+    Stats measure(const TestDescriptor& benchmark) {
+        Stats stats;
+        stats.name = benchmark.name;
+
+        // Output from the body would swamp the report, so it's dropped
+        TestCapture capture;
+        capture.start();
+        try {
+            stats.iterations = calibrate(benchmark.func);
+            timeBatch(benchmark.func, stats.iterations);
+            perf::ThreadCounters* counters = settings_.perf
+                ? &perf::ThreadCounters::forThisThread(settings_.perfHardware)
+                : nullptr;
+            if (counters) {
+                counters->start();
+            }
+            for (size_t i = 0; i < settings_.numSamples; ++i) {
+                stats.samples.push_back(
+                        timeBatch(benchmark.func, stats.iterations)
+                        / stats.iterations);
+            }
+            if (counters) {
+                stats.counters = counters->stop();
+            }
+        } catch (assert::assertion_error& e) {
+            stats.failed = true;
+            stats.failure = e.what();
+        } catch (std::exception& e) {
+            stats.failed = true;
+            stats.failure = std::string("failed with exception: ") + e.what();
+        }
+        capture.stop();
+
+        if (!stats.samples.empty()) {
+            summarize(stats);
+        }
+        return stats;
+    }
+
+    size_t calibrate(voidFunc func) const {
+        const double targetNs = settings_.sampleMs * 1e6;
+        size_t iterations = 1;
+        while (true) {
+            double elapsed = timeBatch(func, iterations);
+            if (elapsed >= targetNs || iterations >= (size_t(1) << 40)) {
+                return iterations;
+            }
+
+            // Aim a little past the target, but don't grow more than 10x at
+            // once in case the first batches were unusually fast
+            double scale = elapsed > 0 ? targetNs * 1.2 / elapsed : 10;
+            iterations = static_cast<size_t>(
+                    iterations * std::clamp(scale, 2.0, 10.0));
+        }
+    }
+
+    // Returns nanoseconds for the whole batch
+    static double timeBatch(voidFunc func, size_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            func();
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    static void summarize(Stats& stats) {
+        std::vector<double> sorted = stats.samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        stats.min = sorted.front();
+        stats.median = n % 2
+            ? sorted[n / 2]
+            : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+        double sum = 0;
+        for (double sample : sorted) {
+            sum += sample;
+        }
+        stats.mean = sum / n;
+
+        double squares = 0;
+        for (double sample : sorted) {
+            squares += (sample - stats.mean) * (sample - stats.mean);
+        }
+        stats.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    }
+
+    static void printStats(const Stats& stats) {
+        if (stats.failed) {
+            std::cout << print::red(stats.name + std::string("...")) << std::endl;
+            std::cout << print::red(std::string("    ") + stats.failure)
+                << std::endl;
+            return;
+        }
+
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                "    %.2f ns/op (median)  mean %.2f  stddev %.2f  min %.2f"
+                "  [%zu samples x %zu iterations]",
+                stats.median, stats.mean, stats.stddev, stats.min,
+                stats.samples.size(), stats.iterations);
+        std::cout << print::green(stats.name + std::string("...")) << std::endl;
+        std::cout << line << std::endl;
+
+        // Per iteration, except the page faults and context switches, which
+        // are rare enough that per iteration would round them all to 0
+        const perf::Counts& counts = stats.counters;
+        const double ops = static_cast<double>(stats.iterations)
+            * stats.samples.size();
+        if (counts.source == perf::Counts::s_hardware) {
+            std::snprintf(line, sizeof(line),
+                    "    %.1f cycles/op  %.1f instructions/op  IPC %.2f"
+                    "  cache misses %.2f%%  branch misses %.2f%%",
+                    counts.cycles / ops, counts.instructions / ops,
+                    counts.ipc(), counts.cacheMissRate(),
+                    counts.branchMissRate());
+            std::cout << line << std::endl;
+        }
+        if (counts.source != perf::Counts::s_none) {
+            std::snprintf(line, sizeof(line),
+                    "    %llu page faults, %llu context switches in all samples",
+                    static_cast<unsigned long long>(counts.pageFaults),
+                    static_cast<unsigned long long>(counts.contextSwitches));
+            std::cout << line << std::endl;
+        }
+    }
+
+    static void writeJson(const std::vector<Stats>& results,
+            const std::string& path) {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Couldn't write benchmark results to " + path);
+        }
+
+        out << "{\"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Stats& stats = results[i];
+            out << (i ? "," : "") << "\n  {\"name\": \""
+                << print::escapeJson(stats.name) << "\", \"failed\": "
+                << (stats.failed ? "true" : "false");
+            if (stats.failed) {
+                out << ", \"failure\": \""
+                    << print::escapeJson(stats.failure) << "\"}";
+                continue;
+            }
+
+            out << ", \"iterations\": " << stats.iterations
+                << ", \"ns_per_op\": " << stats.median
+                << ", \"mean_ns\": " << stats.mean
+                << ", \"median_ns\": " << stats.median
+                << ", \"stddev_ns\": " << stats.stddev
+                << ", \"min_ns\": " << stats.min
+                << ", \"samples_ns\": [";
+            for (size_t j = 0; j < stats.samples.size(); ++j) {
+                out << (j ? ", " : "") << stats.samples[j];
+            }
+            out << "]";
+
+            const perf::Counts& counts = stats.counters;
+            const double ops = static_cast<double>(stats.iterations)
+                * stats.samples.size();
+            if (counts.source == perf::Counts::s_hardware) {
+                out << ", \"cycles_per_op\": " << counts.cycles / ops
+                    << ", \"instructions_per_op\": " << counts.instructions / ops
+                    << ", \"ipc\": " << counts.ipc()
+                    << ", \"cache_miss_rate\": " << counts.cacheMissRate() / 100
+                    << ", \"branch_miss_rate\": " << counts.branchMissRate() / 100;
+            }
+            if (counts.source != perf::Counts::s_none) {
+                out << ", \"page_faults\": " << counts.pageFaults
+                    << ", \"context_switches\": " << counts.contextSwitches;
+            }
+            out << "}";
+        }
+        out << "\n]}\n";
+    }
+
+    Settings settings_;
+};
+
+} // namespace bench
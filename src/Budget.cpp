@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Allocations.h"
+#include "Budget.h"
+#include "BudgetGate.h"
+#include "ConcurrentRun.h"
+
+namespace budget {
+
+namespace {
+
+// ASSERT_RUNS_UNDER takes as many samples as fit in this, within the limits
+constexpr double runsTargetNs = 100e6;
+constexpr size_t minRunSamples = 5;
+constexpr size_t maxRunSamples = 51;
+
+// ASSERT_NS_PER_OP_LT times this many batches of about this long
+constexpr size_t opSamples = 15;
+constexpr double opBatchNs = 1e6;
+
+double timeBatch(Block block, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        block.run(block.context);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+double median(std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    return n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+// Has the gate to itself for as long as it exists, unless it's on one of a
+// TEST_CONCURRENT's threads, whose test already holds the gate
+class Exclusive {
+  public:
+    Exclusive() : locked_(concurrent::current == nullptr) {
+        if (locked_) {
+            gate().lockExclusive();
+        }
+    }
+
+    ~Exclusive() {
+        if (locked_) {
+            gate().unlockExclusive();
+        }
+    }
+
+    Exclusive(const Exclusive&) = delete;
+    Exclusive& operator=(const Exclusive&) = delete;
+
+  private:
+    bool locked_;
+};
+
+// 850ns, 12.5us, 3.21ms, 1.5s
+std::string describeNs(double ns) {
+    const char* unit = "ns";
+    if (ns >= 1e9) {
+        ns /= 1e9;
+        unit = "s";
+    } else if (ns >= 1e6) {
+        ns /= 1e6;
+        unit = "ms";
+    } else if (ns >= 1e3) {
+        ns /= 1e3;
+        unit = "us";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3g%s", ns, unit);
+    return text;
+}
+
+} // namespace
+
+Gate& gate() {
+    static Gate instance;
+    return instance;
+}
+
+Measurement measureRuns_(Block block) {
+    Exclusive exclusive;
+    const double warmupNs = timeBatch(block, 1);
+    size_t count = warmupNs > 0
+        ? static_cast<size_t>(runsTargetNs / warmupNs) : maxRunSamples;
+    count = std::clamp(count, minRunSamples, maxRunSamples) | 1;
+
+    std::vector<double> samples;
+    {
+        alloc::Pause pause;
+        samples.reserve(count);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        samples.push_back(timeBatch(block, 1));
+    }
+
+    Measurement measured;
+    measured.medianNs = median(samples);
+    measured.samples = count;
+    return measured;
+}
+
+Measurement measurePerOp_(Block block) {
+    Exclusive exclusive;
+    // Grown like a BENCHMARK's until one batch takes long enough
+    size_t iterations = 1;
+    while (iterations < (size_t(1) << 30)) {
+        const double elapsed = timeBatch(block, iterations);
+        if (elapsed >= opBatchNs) {
+            break;
+        }
+        const double scale = elapsed > 0 ? opBatchNs * 1.2 / elapsed : 10;
+        iterations = static_cast<size_t>(
+                iterations * std::clamp(scale, 2.0, 10.0));
+    }
+
+    std::vector<double> samples;
+    {
+        alloc::Pause pause;
+        samples.reserve(opSamples);
+    }
+    for (size_t i = 0; i < opSamples; ++i) {
+        samples.push_back(timeBatch(block, iterations) / iterations);
+    }
+
+    Measurement measured;
+    measured.medianNs = median(samples);
+    measured.samples = opSamples;
+    measured.iterations = iterations;
+    return measured;
+}
+
+void failRunsUnder_(
+        const char* file, int line, const char* block,
+        double limitNs, const Measurement& measured) {
+    alloc::Pause pause;
+    throw assert::assertion_error(assert::location_(file, line)
+            + "Failed asserting that " + block + " runs in under "
+            + describeNs(limitNs) + ".\n    Median: "
+            + describeNs(measured.medianNs) + " over "
+            + std::to_string(measured.samples) + " runs");
+}
+
+void failNsPerOp_(
+        const char* file, int line, const char* block,
+        double limitNs, const Measurement& measured) {
+    alloc::Pause pause;
+    throw assert::assertion_error(assert::location_(file, line)
+            + "Failed asserting that " + block + " takes less than "
+            + describeNs(limitNs) + " per op.\n    Median: "
+            + describeNs(measured.medianNs) + " per op over "
+            + std::to_string(measured.samples) + " batches of "
+            + std::to_string(measured.iterations));
+}
+
+} // namespace budget
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include "Assert.h"
+
+/* Performance budgets, checked like any other assertion:
+ *
+ *     TEST("SmallSortIsFast") {
+ *         std::vector<int> v = shuffled(100);
+ *         ASSERT_RUNS_UNDER(20us, {
+ *             std::vector<int> copy = v;
+ *             std::sort(copy.begin(), copy.end());
+ *         });
+ *         ASSERT_NS_PER_OP_LT(30, bench::DoNotOptimize(table.find(key)));
+ *     }
+ *
+ * ASSERT_RUNS_UNDER runs the block once to warm up, then as many more times
+ * as fit in about 100ms (at least 5, at most 51), and compares the median
+ * with the limit. ASSERT_NS_PER_OP_LT calls the block in batches sized like
+ * a BENCHMARK's, about a millisecond each, and compares the median time per
+ * call over 15 batches. The median shrugs off the odd preemption that would
+ * fail a check on the mean or the maximum.
+ *
+ * While a budget is being measured, the runner holds back every other
+ * in-process test: ones that are running get to finish, and none start
+ * until the measurement is done. With --isolate that only covers the tests
+ * in the same worker process.
+ *
+ * The block runs in a lambda, so anything it computes and drops can be
+ * optimized away; wrap results in bench::DoNotOptimize. Inside a
+ * TEST_CONCURRENT nothing is held back, since the test's own threads are
+ * the point there.
+ */
+namespace budget {
+
+// A block to time, called through a plain function pointer
+struct Block {
+    void (*run)(void* context);
+    void* context;
+
+    template <typename F>
+    static Block of(F& func) {
+        return Block{[](void* context) { (*static_cast<F*>(context))(); }, &func};
+    }
+};
+
+struct Measurement {
+    // Median over the samples, of one run of the block (ASSERT_RUNS_UNDER)
+    // or one call in a batch (ASSERT_NS_PER_OP_LT)
+    double medianNs = 0;
+    size_t samples = 0;
+    // Calls per sample
+    size_t iterations = 1;
+};
+
+Measurement measureRuns_(Block block);
+Measurement measurePerOp_(Block block);
+
+template <typename Rep, typename Period>
+double toNs_(std::chrono::duration<Rep, Period> duration) {
+    return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+[[noreturn]] ASSERT_COLD_ void failRunsUnder_(
+        const char* file, int line, const char* block,
+        double limitNs, const Measurement& measured);
+
+[[noreturn]] ASSERT_COLD_ void failNsPerOp_(
+        const char* file, int line, const char* block,
+        double limitNs, const Measurement& measured);
+
+} // namespace budget
+
+// ASSERT_RUNS_UNDER(limit, block), with a std::chrono duration for the limit
+#define ASSERT_RUNS_UNDER(limit, ...) \
+    do { \
+        auto budgetBlock_ = [&]() { __VA_ARGS__; }; \
+        const double budgetLimitNs_ = budget::toNs_(limit); \
+        const budget::Measurement budgetMeasured_ = \
+            budget::measureRuns_(budget::Block::of(budgetBlock_)); \
+        if (!(budgetMeasured_.medianNs < budgetLimitNs_)) { \
+            budget::failRunsUnder_(__FILE__, __LINE__, #__VA_ARGS__, \
+                    budgetLimitNs_, budgetMeasured_); \
+        } \
+    } while (0)
+
+// ASSERT_NS_PER_OP_LT(nanoseconds, block)
+#define ASSERT_NS_PER_OP_LT(ns, ...) \
+    do { \
+        auto budgetBlock_ = [&]() { __VA_ARGS__; }; \
+        const double budgetLimitNs_ = static_cast<double>(ns); \
+        const budget::Measurement budgetMeasured_ = \
+            budget::measurePerOp_(budget::Block::of(budgetBlock_)); \
+        if (!(budgetMeasured_.medianNs < budgetLimitNs_)) { \
+            budget::failNsPerOp_(__FILE__, __LINE__, #__VA_ARGS__, \
+                    budgetLimitNs_, budgetMeasured_); \
+        } \
+    } while (0)
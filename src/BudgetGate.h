@@ -0,0 +1,195 @@
+#pragma once
+
+#include <condition_variable>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <optional>
+
+#include <pthread.h>
+
+#include "Allocations.h"
+#include "Trace.h"
+
+/* What holds tests back while a budget (see Budget.h) is measured. It's a
+ * readers-writer lock where the readers are test bodies and the writers are
+ * measurements, with two differences from std::shared_mutex:
+ *
+ * - A waiting measurement stops new tests from starting, so a steady stream
+ *   of short tests can't keep it waiting forever.
+ * - The measurement is made from inside a test, whose own hold is let go
+ *   while it waits and taken back afterwards.
+ *
+ * Holds are kept by thread, so when the watchdog gives up on a thread,
+ * abandon() can drop whatever it held. Anything that thread does with the
+ * gate afterwards is ignored.
+ *
+ * Each thread finds its Holder through a thread_local, not its pthread_t,
+ * which the next thread can be given once this one is gone. The Holder is
+ * dropped when its thread exits, abandoned or not, so a replacement never
+ * inherits one and the list only has the threads still around. There's only
+ * ever the one gate(), so a thread has at most one Holder.
+ */
+namespace budget {
+
+class Gate {
+  public:
+    // Around a test body
+    void enter() {
+        std::unique_lock lock(mutex_);
+        Holder& holder = ownHolder();
+        if (holder.abandoned) {
+            return;
+        }
+        // Only traced when it actually holds the test back
+        std::optional<trace::Span> waiting;
+        if (exclusive_ || numWaiting_ > 0) {
+            waiting.emplace("wait", "budget gate");
+        }
+        changed_.wait(lock, [this]() {
+            return !exclusive_ && numWaiting_ == 0;
+        });
+        holder.shared = true;
+        ++numShared_;
+    }
+
+    void leave() {
+        std::lock_guard lock(mutex_);
+        Holder& holder = ownHolder();
+        if (holder.shared) {
+            holder.shared = false;
+            --numShared_;
+            changed_.notify_all();
+        }
+    }
+
+    // Around a measurement. Waits for every other test on the gate to leave.
+    void lockExclusive() {
+        std::unique_lock lock(mutex_);
+        Holder& holder = ownHolder();
+        if (holder.abandoned || holder.exclusive++ > 0) {
+            return;
+        }
+        holder.resumeShared = holder.shared;
+        if (holder.shared) {
+            holder.shared = false;
+            --numShared_;
+        }
+        holder.waiting = true;
+        ++numWaiting_;
+        std::optional<trace::Span> waiting;
+        if (exclusive_ || numShared_ > 0) {
+            waiting.emplace("wait", "budget gate, exclusive");
+        }
+        changed_.wait(lock, [this, &holder]() {
+            return holder.abandoned || (!exclusive_ && numShared_ == 0);
+        });
+        if (holder.abandoned) {
+            return;
+        }
+        holder.waiting = false;
+        --numWaiting_;
+        exclusive_ = true;
+    }
+
+    void unlockExclusive() {
+        std::lock_guard lock(mutex_);
+        Holder& holder = ownHolder();
+        if (holder.abandoned || --holder.exclusive > 0) {
+            return;
+        }
+        exclusive_ = false;
+        if (holder.resumeShared) {
+            holder.shared = true;
+            ++numShared_;
+        }
+        changed_.notify_all();
+    }
+
+    // thread has to still be running (stuck, say), so its pthread_t is its
+    // own
+    void abandon(pthread_t thread) {
+        std::lock_guard lock(mutex_);
+        for (Holder& holder : holders_) {
+            if (pthread_equal(holder.thread, thread)) {
+                release(holder);
+                holder.abandoned = true;
+                changed_.notify_all();
+                return;
+            }
+        }
+    }
+
+  private:
+    struct Holder {
+        bool shared = false;
+        // Nesting depth of lockExclusive
+        int exclusive = 0;
+        bool waiting = false;
+        // Whether to take the shared hold back after the measurement
+        bool resumeShared = false;
+        bool abandoned = false;
+        pthread_t thread;
+    };
+
+    // Erases the calling thread's Holder when it exits
+    struct ThreadEntry {
+        Gate* gate = nullptr;
+        std::list<Holder>::iterator holder;
+
+        ~ThreadEntry() {
+            if (gate) {
+                gate->forget(holder);
+            }
+        }
+    };
+
+    // The calling thread's Holder, made on first use. mutex_ has to be held.
+    Holder& ownHolder() {
+        thread_local ThreadEntry entry;
+        if (entry.gate != this) {
+            alloc::Pause pause;
+            holders_.emplace_back();
+            holders_.back().thread = pthread_self();
+            entry.holder = std::prev(holders_.end());
+            entry.gate = this;
+        }
+        return *entry.holder;
+    }
+
+    // Gives back whatever holder has and resets it. mutex_ has to be held.
+    void release(Holder& holder) {
+        if (holder.shared) {
+            --numShared_;
+        }
+        if (holder.waiting) {
+            --numWaiting_;
+        } else if (holder.exclusive > 0) {
+            exclusive_ = false;
+        }
+        const pthread_t thread = holder.thread;
+        holder = Holder();
+        holder.thread = thread;
+    }
+
+    void forget(std::list<Holder>::iterator holder) {
+        std::lock_guard lock(mutex_);
+        if (!holder->abandoned) {
+            release(*holder);
+            changed_.notify_all();
+        }
+        holders_.erase(holder);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::list<Holder> holders_;
+    size_t numShared_ = 0;
+    size_t numWaiting_ = 0;
+    bool exclusive_ = false;
+};
+
+// The one gate every test in the process goes through. In Budget.cpp.
+Gate& gate();
+
+} // namespace budget
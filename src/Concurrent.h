@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+
+#include "TestRegistry.h"
+
+/* Contention tests. TEST_CONCURRENT runs its body on several threads at
+ * once: the threads are started, wait at a spin barrier until the last one
+ * is ready, and are let go together, so they really do hit the code under
+ * test at the same time.
+ *
+ *     TEST_CONCURRENT("QueueKeepsEverything", 8) {
+ *         for (int i = 0; i < 10000; ++i) {
+ *             queue.push(test::threadIndex() * 10000 + i);
+ *             test::interleave();
+ *             ASSERT_TRUE(queue.pop().has_value());
+ *             test::countOps();
+ *         }
+ *     }
+ *
+ * A failure on one thread doesn't stop the others. Every thread's
+ * failures are collected and reported together, each with the threads that
+ * hit it, and so is the output of every thread.
+ *
+ * test::interleave() marks a point where a different interleaving might
+ * matter. It does nothing unless the test has the test::jitter annotation,
+ * and then it randomly yields, spins or sleeps for a moment, seeded from
+ * --seed, to shake out orderings that rarely happen on their own.
+ *
+ * Operations counted with test::countOps() are reported as throughput, in
+ * total and per thread, so the same test doubles as a scalability check.
+ * Allocations on the test's threads aren't tracked.
+ */
+namespace test {
+
+// Which of the test's threads this is, from 0. Always 0 outside a
+// TEST_CONCURRENT.
+size_t threadIndex();
+
+// How many threads the test runs on. 1 outside a TEST_CONCURRENT.
+size_t numThreads();
+
+// A point where the thread may be held up a little, with test::jitter
+void interleave();
+
+// Adds to this thread's operation count for the throughput report
+void countOps(uint64_t ops = 1);
+
+// Make test::interleave() actually interleave
+struct jitter {
+    void apply(TestDescriptor& test) const {
+        test.jitter = true;
+    }
+};
+
+namespace detail {
+
+// The annotation TEST_CONCURRENT adds, holding the thread count and then
+// whatever annotations came after it
+template <typename... Annotations>
+struct concurrent {
+    explicit concurrent(size_t threads, const Annotations&... annotations)
+        : threads_(threads), annotations_(annotations...) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.numThreads = threads_ ? threads_ : 1;
+        std::apply([&test](const auto&... annotation) {
+            (annotation.apply(test), ...);
+        }, annotations_);
+    }
+
+  private:
+    size_t threads_;
+    std::tuple<Annotations...> annotations_;
+};
+
+} // namespace detail
+
+} // namespace test
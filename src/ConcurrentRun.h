@@ -0,0 +1,218 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+#include "Assert.h"
+#include "Property.h"
+#include "TestPrinter.h"
+#include "TestRegistry.h"
+#include "TestResult.h"
+#include "Timing.h"
+#include "Trace.h"
+
+/* Runs a TEST_CONCURRENT (see Concurrent.h) for the runner: starts its
+ * threads, lets them go together, and gathers up what they did.
+ */
+namespace concurrent {
+
+// What test::threadIndex() and friends see on one of the test's threads
+struct ThreadState {
+    size_t index = 0;
+    size_t count = 1;
+    bool jitter = false;
+    test::Random random{0};
+    uint64_t ops = 0;
+};
+
+inline thread_local ThreadState* current = nullptr;
+
+/* A one-shot barrier that spins instead of blocking, so the threads come out
+ * of it within a few hundred nanoseconds of each other rather than whenever
+ * the scheduler gets round to waking them. It yields now and then in case
+ * there are more threads than cores.
+ */
+class SpinBarrier {
+  public:
+    explicit SpinBarrier(size_t count) : count_(count) {
+    }
+
+    void arriveAndWait() {
+        arrived_.fetch_add(1, std::memory_order_acq_rel);
+        for (size_t spins = 1; arrived_.load(std::memory_order_acquire) < count_;
+                ++spins) {
+            if (spins % 1024 == 0) {
+                sched_yield();
+            }
+        }
+    }
+
+    // Lets everyone waiting go without the rest arriving
+    void open() {
+        arrived_.store(count_, std::memory_order_release);
+    }
+
+  private:
+    const size_t count_;
+    std::atomic<size_t> arrived_{0};
+};
+
+// test::interleave() on a thread with jitter: usually nothing, otherwise a
+// yield, a short spin or a short sleep
+inline void interleave(ThreadState& state) {
+    const uint64_t roll = state.random.next() % 16;
+    if (roll < 8) {
+        return;
+    }
+    if (roll < 12) {
+        sched_yield();
+    } else if (roll < 15) {
+        const uint64_t spins = state.random.next() % 1000;
+        for (uint64_t i = 0; i < spins; ++i) {
+            // Keeps the compiler from dropping the loop, without a volatile
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+    } else {
+        std::this_thread::sleep_for(
+                std::chrono::microseconds(state.random.next() % 50));
+    }
+}
+
+/* Runs the body on test.numThreads threads and waits for all of them. Each
+ * thread's operation count and time are put in ops. If any thread failed,
+ * this then throws one assertion_error listing every distinct failure with
+ * the threads that hit it.
+ *
+ * Output from each thread goes to a capture of its own, and is copied into
+ * the calling thread's capture, one thread after another, once they've all
+ * finished.
+ */
+inline void run(const TestDescriptor& test, uint64_t seed,
+        std::vector<TestResult::ThreadOps>& ops) {
+    struct Thread {
+        ThreadState state;
+        TestCapture capture;
+        std::string failure;
+        double ms = 0;
+    };
+
+    const size_t count = test.numThreads;
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (size_t i = 0; i < count; ++i) {
+        threads.push_back(std::make_unique<Thread>());
+        ThreadState& state = threads.back()->state;
+        state.index = i;
+        state.count = count;
+        state.jitter = test.jitter;
+        state.random = test::Random::forCase(seed, i);
+    }
+
+    SpinBarrier barrier(count);
+    // Set if not every thread could be started, for the ones that were
+    std::atomic<bool> cancelled{false};
+    std::vector<std::thread> running;
+    running.reserve(count);
+    try {
+        for (auto& owned : threads) {
+            Thread* thread = owned.get();
+            running.emplace_back([&test, &barrier, &cancelled, thread]() {
+                if (trace::Recorder* recorder = trace::Recorder::active()) {
+                    recorder->nameThread(test.name + " thread "
+                            + std::to_string(thread->state.index));
+                }
+                current = &thread->state;
+                thread->capture.start();
+                barrier.arriveAndWait();
+                if (cancelled.load(std::memory_order_acquire)) {
+                    thread->capture.stop();
+                    current = nullptr;
+                    return;
+                }
+
+                timing::Stopwatch stopwatch;
+                {
+                    trace::Span span("test", test.name);
+                    try {
+                        test.func();
+                    } catch (assert::assertion_error& e) {
+                        thread->failure = e.what();
+                    } catch (std::exception& e) {
+                        thread->failure = std::string("failed with exception: ")
+                            + e.what();
+                    } catch (...) {
+                        thread->failure = "failed with an unknown exception";
+                    }
+                }
+                thread->ms = stopwatch.wallMs();
+
+                std::string expectFailures = assert::takeExpectFailures_();
+                if (!expectFailures.empty()) {
+                    thread->failure = thread->failure.empty() ? expectFailures
+                        : expectFailures + "\n    " + thread->failure;
+                }
+                thread->capture.stop();
+                current = nullptr;
+            });
+        }
+    } catch (...) {
+        // The threads already started are waiting for the rest. They're let
+        // go without running the body, and joined, before giving up.
+        cancelled.store(true, std::memory_order_release);
+        barrier.open();
+        for (auto& thread : running) {
+            thread.join();
+        }
+        throw;
+    }
+    for (auto& thread : running) {
+        thread.join();
+    }
+
+    alloc::Pause pause;
+    TestCapture* capture = TestCapture::active();
+    // Each failure message, with the threads that hit it in order
+    std::map<std::string, std::vector<size_t>> failures;
+    std::vector<std::string> failureOrder;
+    ops.clear();
+    for (auto& thread : threads) {
+        ops.push_back(TestResult::ThreadOps{thread->state.ops, thread->ms});
+        std::string text;
+        if (capture && thread->capture.take(TestCapture::c_out, text)) {
+            capture->stream(TestCapture::c_out) << text;
+        }
+        if (capture && thread->capture.take(TestCapture::c_err, text)) {
+            capture->stream(TestCapture::c_err) << text;
+        }
+        if (!thread->failure.empty()) {
+            auto& indices = failures[thread->failure];
+            if (indices.empty()) {
+                failureOrder.push_back(thread->failure);
+            }
+            indices.push_back(thread->state.index);
+        }
+    }
+    if (failures.empty()) {
+        return;
+    }
+
+    std::string message;
+    for (const std::string& failure : failureOrder) {
+        const auto& indices = failures[failure];
+        message += message.empty() ? "" : "\n    ";
+        message += indices.size() == 1 ? "thread " : "threads ";
+        for (size_t i = 0; i < indices.size(); ++i) {
+            message += (i ? ", " : "") + std::to_string(indices[i]);
+        }
+        message += ": " + failure;
+    }
+    throw assert::assertion_error(message);
+}
+
+} // namespace concurrent
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "Assert.h"
+#include "Async.h"
+#include "BudgetGate.h"
+#include "TestPrinter.h"
+#include "TestRegistry.h"
+#include "TestResult.h"
+#include "Trace.h"
+#include "Timing.h"
+#include "Watchdog.h"
+
+/* Runs TEST_ASYNC tests (see Async.h) on the calling thread, all at once.
+ *
+ * Every test is a suspended coroutine. A suspended coroutine is waiting on
+ * exactly one thing: a timer, a file descriptor (through epoll), or nothing,
+ * in which case it's in the ready queue. Each turn of the loop resumes
+ * everything that's ready, then sleeps in epoll_wait until the next timer or
+ * test deadline, or until a file descriptor someone is waiting on is ready.
+ *
+ * The loop switches each test's output capture in and out around every
+ * resume, and collects its EXPECT_* failures, so several tests sharing the
+ * thread don't see each other's output or failures.
+ *
+ * Deadlines are only checked between resumes, so a test that blocks inside
+ * one (a plain sleep or read instead of co_await) would hold up the loop
+ * forever. Given a watchdog slot (watchWith()), the loop has every resume of
+ * a test with a timeout watched. If one runs past the test's deadline, the
+ * watchdog reports that test as timed out, and every other test left on the
+ * loop with it, since they can't run either. The loop's thread is then given
+ * up on like any stuck test's.
+ */
+namespace eventloop {
+
+class EventLoop {
+  public:
+    typedef std::function<void(const TestDescriptor& test, TestResult&& result)>
+        DoneFunc;
+
+    explicit EventLoop(DoneFunc onDone) : onDone_(std::move(onDone)) {
+        epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd_ < 0) {
+            throw std::runtime_error(
+                    std::string("epoll_create1 failed: ") + std::strerror(errno));
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    ~EventLoop() {
+        close(epollFd_);
+    }
+
+    // The loop running on the calling thread, if any
+    static EventLoop* current() {
+        return current_;
+    }
+
+    /* Watches every resume of a test with a timeout from slot, which has to
+     * belong to the calling thread. onAbandon is called from the watchdog's
+     * thread once a stuck resume's tests have been reported, to replace this
+     * one.
+     */
+    void watchWith(Watchdog::Slot* slot, size_t worker,
+            std::function<void(Watchdog::Slot& slot)> onAbandon) {
+        slot_ = slot;
+        worker_ = worker;
+        onAbandon_ = std::move(onAbandon);
+        onStuck_ = [this](Watchdog::Slot& slot, TestResult&& result) {
+            stuck(slot, std::move(result));
+        };
+    }
+
+    // Queues the test to start once run() is called. No timeout if
+    // timeoutMs is 0.
+    void add(const TestDescriptor& test, double timeoutMs) {
+        auto run = std::make_unique<Run>();
+        run->test = &test;
+        run->timeoutMs = timeoutMs;
+        runs_.push_back(std::move(run));
+    }
+
+    // Runs every test added until it has finished or timed out
+    void run() {
+        current_ = this;
+        for (auto& run : runs_) {
+            if (trace::Recorder* recorder = trace::Recorder::active()) {
+                recorder->asyncBegin("async test", run->test->name,
+                        reinterpret_cast<uintptr_t>(run.get()));
+            }
+            run->startMs = timing::steadyMs();
+            run->coroutine = run->test->startAsync();
+            ready_.push_back(Wake{run.get(), run->coroutine});
+        }
+        numLive_ = runs_.size();
+
+        while (numLive_ > 0) {
+            std::deque<Wake> ready;
+            ready.swap(ready_);
+            for (const Wake& wake : ready) {
+                if (!resume(wake)) {
+                    // Given up on by the watchdog. Nothing here is ours now.
+                    return;
+                }
+            }
+            if (numLive_ == 0 || !ready_.empty()) {
+                continue;
+            }
+
+            waitForEvents();
+            fireTimers();
+            enforceDeadlines();
+        }
+        current_ = nullptr;
+    }
+
+    void sleep(double ms, Coroutine coroutine) {
+        if (ms <= 0) {
+            ready_.push_back(Wake{running_, coroutine});
+            return;
+        }
+        timers_.emplace(timing::steadyMs() + ms, Wake{running_, coroutine});
+    }
+
+    void waitFd(int fd, bool forWriting, Coroutine coroutine) {
+        if (fdWaits_.count(fd)) {
+            throw std::runtime_error("Another test is already waiting on fd "
+                    + std::to_string(fd));
+        }
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = forWriting ? EPOLLOUT : EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            throw std::runtime_error("Can't wait on fd " + std::to_string(fd)
+                    + ": " + std::strerror(errno));
+        }
+        fdWaits_.emplace(fd, Wake{running_, coroutine});
+    }
+
+    void finish(const std::string& failure) {
+        running_->finished = true;
+        running_->failure = failure;
+    }
+
+  private:
+    struct Run {
+        const TestDescriptor* test;
+        double timeoutMs = 0;
+        double startMs = 0;
+        Coroutine coroutine;
+        TestCapture capture;
+        // EXPECT_* failures so far, collected after every resume
+        std::string expectFailures;
+        bool finished = false;
+        bool done = false;
+        std::string failure;
+    };
+
+    struct Wake {
+        Run* run;
+        Coroutine coroutine;
+    };
+
+    // Returns false if the watchdog gave up on it, in which case the loop has
+    // to return without touching anything
+    bool resume(const Wake& wake) {
+        Run& run = *wake.run;
+        if (run.done) {
+            return true;
+        }
+        running_ = &run;
+        run.capture.start();
+        budget::gate().enter();
+        const bool watched = slot_ && run.timeoutMs > 0;
+        if (watched) {
+            const double now = timing::steadyMs();
+            Watchdog::begin(slot_, worker_, &run, &run.capture,
+                    std::max(1.0, run.startMs + run.timeoutMs - now), &onStuck_);
+        }
+        {
+            trace::Span span("test", run.test->name);
+            wake.coroutine.resume(wake.coroutine.address);
+        }
+        if (watched && !Watchdog::end(slot_)) {
+            return false;
+        }
+        budget::gate().leave();
+        run.capture.stop();
+        collectExpectFailures(run);
+        running_ = nullptr;
+
+        if (run.finished) {
+            std::string failure = run.expectFailures;
+            if (!run.failure.empty()) {
+                failure += (failure.empty() ? "" : "\n    ") + run.failure;
+            }
+            TestResult result;
+            if (!failure.empty()) {
+                result.fail(TestResult::s_failed, failure);
+            }
+            complete(run, std::move(result));
+        }
+        return true;
+    }
+
+    /* On the watchdog's thread, while this loop's thread is stuck in a resume
+     * of the test in slot. Reports it, and everything else still on the loop,
+     * without touching their coroutines, which belong to the stuck thread.
+     */
+    void stuck(Watchdog::Slot& slot, TestResult&& result) {
+        Run& stuckRun =
+            *static_cast<Run*>(const_cast<void*>(slot.context.load()));
+        const double now = timing::steadyMs();
+        // The watchdog only knew the time left when the resume started
+        TestResult timedOut;
+        timedOut.fail(TestResult::s_timedOut,
+                TestResult::describeTimeout(stuckRun.timeoutMs));
+        timedOut.out = std::move(result.out);
+        timedOut.err = std::move(result.err);
+        report(stuckRun, std::move(timedOut), now);
+        for (auto& run : runs_) {
+            if (!run->done) {
+                TestResult left;
+                left.fail(TestResult::s_timedOut, "stuck behind "
+                        + stuckRun.test->name + " on the same event loop");
+                run->capture.take(TestCapture::c_out, left.out);
+                run->capture.take(TestCapture::c_err, left.err);
+                report(*run, std::move(left), now);
+            }
+        }
+        onAbandon_(slot);
+    }
+
+    static void collectExpectFailures(Run& run) {
+        std::string failures = assert::takeExpectFailures_();
+        if (!failures.empty()) {
+            run.expectFailures += (run.expectFailures.empty() ? "" : "\n    ")
+                + failures;
+        }
+    }
+
+    void waitForEvents() {
+        int timeoutMs = -1;
+        double next = nextDeadline();
+        if (next >= 0) {
+            timeoutMs = static_cast<int>(
+                    std::max(0.0, next - timing::steadyMs())) + 1;
+        } else if (fdWaits_.empty()) {
+            // Suspended on something that isn't ours, with nothing that will
+            // ever wake it
+            for (auto& run : runs_) {
+                if (!run->done) {
+                    TestResult result;
+                    result.fail(TestResult::s_failed,
+                            "suspended on something other than a test::Async, "
+                            "test::sleep, test::readable or test::writable");
+                    abandon(*run, std::move(result));
+                }
+            }
+            return;
+        }
+
+        epoll_event events[64];
+        int count = epoll_wait(epollFd_, events, 64, timeoutMs);
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            auto it = fdWaits_.find(fd);
+            if (it == fdWaits_.end()) {
+                continue;
+            }
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+            ready_.push_back(it->second);
+            fdWaits_.erase(it);
+        }
+    }
+
+    // The earliest timer or test deadline, or -1 if there's neither
+    double nextDeadline() const {
+        double next = timers_.empty() ? -1 : timers_.begin()->first;
+        for (const auto& run : runs_) {
+            if (!run->done && run->timeoutMs > 0) {
+                double deadline = run->startMs + run->timeoutMs;
+                next = next < 0 ? deadline : std::min(next, deadline);
+            }
+        }
+        return next;
+    }
+
+    void fireTimers() {
+        const double now = timing::steadyMs();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            ready_.push_back(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+        }
+    }
+
+    void enforceDeadlines() {
+        const double now = timing::steadyMs();
+        for (auto& run : runs_) {
+            if (!run->done && run->timeoutMs > 0
+                    && now - run->startMs > run->timeoutMs) {
+                TestResult result;
+                result.fail(TestResult::s_timedOut,
+                        TestResult::describeTimeout(run->timeoutMs));
+                abandon(*run, std::move(result));
+            }
+        }
+    }
+
+    // Drops everything the test was waiting on and reports it
+    void abandon(Run& run, TestResult&& result) {
+        for (auto it = timers_.begin(); it != timers_.end();) {
+            it = it->second.run == &run ? timers_.erase(it) : std::next(it);
+        }
+        for (auto it = fdWaits_.begin(); it != fdWaits_.end();) {
+            if (it->second.run == &run) {
+                epoll_ctl(epollFd_, EPOLL_CTL_DEL, it->first, nullptr);
+                it = fdWaits_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        complete(run, std::move(result));
+    }
+
+    // Destroys the test's coroutine, along with anything it was awaiting,
+    // and hands the result on
+    void complete(Run& run, TestResult&& result) {
+        run.capture.start();
+        run.coroutine.destroy(run.coroutine.address);
+        run.capture.stop();
+        assert::takeExpectFailures_();
+        --numLive_;
+
+        if (result.status == TestResult::s_passed
+                && capture::limits.discardPassing) {
+            run.capture.discard();
+        }
+        run.capture.take(TestCapture::c_out, result.out);
+        run.capture.take(TestCapture::c_err, result.err);
+        report(run, std::move(result), timing::steadyMs());
+    }
+
+    void report(Run& run, TestResult&& result, double endMs) {
+        run.done = true;
+        result.startMs = run.startMs;
+        result.endMs = endMs;
+        result.wallMs = result.endMs - result.startMs;
+        if (trace::Recorder* recorder = trace::Recorder::active()) {
+            recorder->asyncEnd("async test", run.test->name,
+                    reinterpret_cast<uintptr_t>(&run),
+                    trace::statusName(result.status));
+        }
+        onDone_(*run.test, std::move(result));
+    }
+
+    DoneFunc onDone_;
+    Watchdog::Slot* slot_ = nullptr;
+    size_t worker_ = 0;
+    std::function<void(Watchdog::Slot& slot)> onAbandon_;
+    Watchdog::TimeoutFunc onStuck_;
+    int epollFd_;
+    std::vector<std::unique_ptr<Run>> runs_;
+    size_t numLive_ = 0;
+    Run* running_ = nullptr;
+    std::deque<Wake> ready_;
+    std::multimap<double, Wake> timers_;
+    std::unordered_map<int, Wake> fdWaits_;
+
+    inline static thread_local EventLoop* current_ = nullptr;
+};
+
+} // namespace eventloop
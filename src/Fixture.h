@@ -0,0 +1,65 @@
+#pragma once
+
+#include <type_traits>
+
+#include "TestRegistry.h"
+
+/* Fixtures for TEST_F. A fixture is any default constructible struct: its
+ * constructor is the setup and its destructor the teardown, and the test body
+ * runs as a member of a struct derived from it, so it can use the fixture's
+ * members directly. A new fixture is made for every run of every test.
+ *
+ * Data that's expensive to build and only ever read goes in a suite instead,
+ * by deriving the fixture from test::Fixture<Suite>. The suite is built once
+ * per process, before any test runs, and every test on every worker thread
+ * gets the same const instance from suite().
+ *
+ *     struct Corpus {
+ *         Corpus() { words = loadWords("words.txt"); }
+ *         std::vector<std::string> words;
+ *     };
+ *
+ *     struct SortFixture : test::Fixture<Corpus> {
+ *         SortFixture() : words(suite().words) {}
+ *         std::vector<std::string> words;
+ *     };
+ *
+ *     TEST_F(SortFixture, "SortsWords") {
+ *         std::sort(words.begin(), words.end());
+ *         ...
+ *     }
+ */
+namespace test {
+
+template <typename Suite>
+struct Fixture {
+    static const Suite& suite() {
+        // Built on first use, which the runner makes happen up front. If the
+        // constructor throws, the next call tries again, so each test using
+        // the suite fails with that exception.
+        static const Suite instance;
+        return instance;
+    }
+};
+
+namespace detail {
+
+template <typename T, typename = void>
+struct hasSuite : std::false_type {};
+
+template <typename T>
+struct hasSuite<T, std::void_t<decltype(T::suite())>> : std::true_type {};
+
+// The annotation TEST_F adds, so the runner can build the suite early
+template <typename F>
+struct fixture {
+    void apply(TestDescriptor& test) const {
+        if constexpr (hasSuite<F>::value) {
+            test.prepare = []() { F::suite(); };
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace test
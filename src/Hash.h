@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace hashing {
+
+// FNV-1a, which unlike std::hash is the same on every platform and build.
+// Pass the previous result as hash to continue a hash over several pieces.
+inline uint64_t fnv1a(const void* data, size_t size,
+        uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t stableHash(const std::string& text) {
+    return fnv1a(text.data(), text.size());
+}
+
+} // namespace hashing
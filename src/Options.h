@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "Allocations.h"
+
+/* Command line flags accepted by every test binary, e.g.
+ *
+ *     ./a.out -j 8 --slowest 10
+ *
+ * Unknown flags are an error so typos don't silently run the whole suite
+ * with default settings.
+ */
+
+struct RunOptions {
+    // Number of worker threads. 0 means std::thread::hardware_concurrency()
+    size_t numWorkers = 0;
+
+    // Print this many of the slowest tests after the results
+    size_t numSlowest = 0;
+
+    // Where per-test durations are kept between runs. Empty disables it.
+    std::string historyPath = ".testframework_history";
+
+    // Where each test's last result is kept, see ResultCache.h. Empty
+    // disables it.
+    std::string resultsPath = ".testframework_results";
+    // Only run the tests that failed last time, or all of them if none did
+    bool onlyFailed = false;
+    // Start the tests that failed last time before any others
+    bool failedFirst = false;
+    // Leave out tests that passed last time and haven't changed since
+    bool skipUnchanged = false;
+
+    // Run each test in a pool of forked worker processes so crashes and
+    // exit() calls only fail that test
+    bool isolate = false;
+
+    // Run every test this many times, with up to this many runs of the same
+    // test at once. test::repeat overrides both for a single test.
+    size_t repeat = 1;
+    size_t concurrency = 1;
+
+    // Stop starting new tests (and new runs of repeated tests) once one fails
+    bool failFast = false;
+
+    // Seconds a test may run before it's reported as timed out and left
+    // behind. 0 means no limit. test::timeout overrides it for a single test.
+    double timeoutSec = 60;
+    // Print the stuck thread's stack when a test times out
+    bool dumpStacks = true;
+
+    // What PROPERTY tests generate their values from. A new one every run
+    // unless given.
+    uint64_t seed = 0;
+
+    // Glob patterns on test names, see TestSelection.h
+    std::vector<std::string> filters;
+    std::vector<std::string> excludes;
+    size_t shardIndex = 0;
+    size_t shardCount = 1;
+    bool shardBalance = false;
+
+    // Print the selected tests instead of running them
+    bool list = false;
+
+    // Print allocation counts and leaks for each test
+    bool reportAllocs = false;
+
+    // Count cycles, cache misses and so on for each test and benchmark, see
+    // PerfCounters.h. Without perfHardware, only page faults and context
+    // switches.
+    bool reportPerf = false;
+    bool perfHardware = true;
+
+    // Extra reports written next to the console output. Empty means off.
+    std::string jsonPath;
+    std::string junitPath;
+
+    // Output capture, see OutputSpool.h. Past captureMemoryBytes a test's
+    // output spills to a temp file, and only the first and last
+    // outputLimitBytes / 2 of it are reported (0 for all of it).
+    size_t captureMemoryBytes = 1 << 20;
+    size_t outputLimitBytes = 1 << 20;
+    bool discardPassingOutput = false;
+
+    // Where to write a timeline of the run, see Trace.h. Empty means don't.
+    std::string tracePath;
+
+    // Live metrics in the Prometheus text format, see Telemetry.h. Empty
+    // path and a negative port mean off.
+    std::string metricsPath;
+    int metricsPort = -1;
+    double metricsIntervalSec = 1;
+
+    // Run the BENCHMARKs instead of the TESTs
+    bool runBenchmarks = false;
+    size_t benchSamples = 10;
+    size_t benchSampleMs = 50;
+    // Where to write benchmark results as JSON. Empty means don't.
+    std::string benchOutPath;
+};
+
+namespace options {
+
+inline double parseSeconds(const std::string& flag, const std::string& value) {
+    size_t end = 0;
+    double parsed = -1;
+    try {
+        parsed = std::stod(value, &end);
+    } catch (std::exception&) {
+        end = 0;
+    }
+
+    if (value.empty() || end != value.size() || !(parsed >= 0)) {
+        throw std::runtime_error(
+                "Expected a non-negative number of seconds for " + flag
+                + ", got \"" + value + "\"");
+    }
+
+    return parsed;
+}
+
+inline size_t parseSize(const std::string& flag, const std::string& value) {
+    size_t end = 0;
+    unsigned long long parsed = 0;
+    try {
+        parsed = std::stoull(value, &end);
+    } catch (std::exception&) {
+        end = 0;
+    }
+
+    if (value.empty() || end != value.size() || value[0] == '-') {
+        throw std::runtime_error(
+                "Expected a non-negative number for " + flag + ", got \""
+                + value + "\"");
+    }
+
+    return static_cast<size_t>(parsed);
+}
+
+// "a,b" -> {"a", "b"}, appended to out
+inline void splitPatterns(const std::string& value, std::vector<std::string>& out) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string::npos) {
+            comma = value.size();
+        }
+        if (comma > start) {
+            out.push_back(value.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+}
+
+} // namespace options
+
+inline RunOptions parseOptions(int argc, char** argv) {
+    RunOptions opts;
+    opts.seed = std::random_device()();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        auto nextArg = [&]() {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+            return std::string(argv[++i]);
+        };
+
+        if (arg == "-j") {
+            opts.numWorkers = options::parseSize(arg, nextArg());
+        } else if (arg.rfind("-j", 0) == 0) {
+            opts.numWorkers = options::parseSize("-j", arg.substr(2));
+        } else if (arg == "--slowest") {
+            opts.numSlowest = options::parseSize(arg, nextArg());
+        } else if (arg == "--history") {
+            opts.historyPath = nextArg();
+        } else if (arg == "--no-history") {
+            opts.historyPath.clear();
+        } else if (arg == "--results") {
+            opts.resultsPath = nextArg();
+        } else if (arg == "--no-results") {
+            opts.resultsPath.clear();
+        } else if (arg == "--only-failed") {
+            opts.onlyFailed = true;
+        } else if (arg == "--failed-first") {
+            opts.failedFirst = true;
+        } else if (arg == "--skip-unchanged") {
+            opts.skipUnchanged = true;
+        } else if (arg == "--isolate") {
+            opts.isolate = true;
+        } else if (arg == "--repeat") {
+            opts.repeat = options::parseSize(arg, nextArg());
+        } else if (arg == "--concurrency") {
+            opts.concurrency = options::parseSize(arg, nextArg());
+        } else if (arg == "--fail-fast") {
+            opts.failFast = true;
+        } else if (arg == "--filter") {
+            options::splitPatterns(nextArg(), opts.filters);
+        } else if (arg == "--exclude") {
+            options::splitPatterns(nextArg(), opts.excludes);
+        } else if (arg == "--shard-index") {
+            opts.shardIndex = options::parseSize(arg, nextArg());
+        } else if (arg == "--shard-count") {
+            opts.shardCount =
+                std::max<size_t>(1, options::parseSize(arg, nextArg()));
+        } else if (arg == "--shard-balance") {
+            opts.shardBalance = true;
+        } else if (arg == "--list") {
+            opts.list = true;
+        } else if (arg == "--timeout") {
+            opts.timeoutSec = options::parseSeconds(arg, nextArg());
+        } else if (arg == "--no-stack-dump") {
+            opts.dumpStacks = false;
+        } else if (arg == "--seed") {
+            opts.seed = options::parseSize(arg, nextArg());
+        } else if (arg == "--allocs") {
+            if (!alloc::tracking()) {
+                throw std::runtime_error("--allocs needs the allocation hooks. "
+                        "Link libtestframework_allocs.a after libtestframework.a.");
+            }
+            opts.reportAllocs = true;
+        } else if (arg == "--perf") {
+            opts.reportPerf = true;
+        } else if (arg == "--perf-rusage") {
+            opts.reportPerf = true;
+            opts.perfHardware = false;
+        } else if (arg == "--json") {
+            opts.jsonPath = nextArg();
+        } else if (arg == "--junit") {
+            opts.junitPath = nextArg();
+        } else if (arg == "--capture-memory") {
+            opts.captureMemoryBytes = options::parseSize(arg, nextArg());
+        } else if (arg == "--output-limit") {
+            opts.outputLimitBytes = options::parseSize(arg, nextArg());
+        } else if (arg == "--discard-passing-output") {
+            opts.discardPassingOutput = true;
+        } else if (arg == "--trace") {
+            opts.tracePath = nextArg();
+        } else if (arg == "--metrics-file") {
+            opts.metricsPath = nextArg();
+        } else if (arg == "--metrics-port") {
+            size_t port = options::parseSize(arg, nextArg());
+            if (port > 65535) {
+                throw std::runtime_error("Port out of range for " + arg);
+            }
+            opts.metricsPort = static_cast<int>(port);
+        } else if (arg == "--metrics-interval") {
+            opts.metricsIntervalSec = options::parseSeconds(arg, nextArg());
+        } else if (arg == "--bench") {
+            opts.runBenchmarks = true;
+        } else if (arg == "--bench-samples") {
+            opts.benchSamples =
+                std::max<size_t>(1, options::parseSize(arg, nextArg()));
+        } else if (arg == "--bench-sample-ms") {
+            opts.benchSampleMs = options::parseSize(arg, nextArg());
+        } else if (arg == "--bench-out") {
+            opts.benchOutPath = nextArg();
+        } else {
+            throw std::runtime_error("Unknown flag: " + arg);
+        }
+    }
+
+    return opts;
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Where a test's output goes while it's being captured, so a test that logs
+ * gigabytes doesn't take the runner down with it.
+ *
+ * The first limits.memoryBytes of it are kept in memory. Anything past that
+ * is appended to a temp file, unlinked as soon as it's made so it goes away
+ * with the spool (or the process). Appends to the file are staged in
+ * memory and written spillChunk bytes at a time, since tests that log a lot
+ * tend to do it a line at a time. The file is only read back, through mmap,
+ * for the part of the output that's reported: when there's more than
+ * limits.shownBytes of it, that's the head and the tail with a note of how
+ * much was left out in between.
+ *
+ * With limits.discardPassing most output is thrown away unread, so nothing
+ * goes to disk at all. The spool keeps the head that would be reported in
+ * memory, and a rolling window of the tail, and only counts what falls out
+ * between them. Both are cut down to fit in limits.memoryBytes if they have
+ * to be, window and all.
+ *
+ * If the spill file can't be made or written to, what doesn't fit in memory
+ * is counted and thrown away, and read() ends with a note of how much was
+ * lost and why. The capture is written from inside a streambuf, where an
+ * exception would only leave the stream broken and the rest of the test's
+ * output silently gone.
+ */
+namespace capture {
+
+struct Limits {
+    // Kept in memory before spilling to disk
+    size_t memoryBytes = 1 << 20;
+    // Reported, half from the start and half from the end. 0 for no limit.
+    size_t shownBytes = 1 << 20;
+    // Drop the output of tests that pass instead of reporting it
+    bool discardPassing = false;
+};
+
+// Set once by the runner, before any test starts
+inline Limits limits;
+
+class Spool {
+  public:
+    // Bytes staged before each write to the spill file
+    static constexpr size_t spillChunk = 64 << 10;
+
+    Spool() = default;
+
+    Spool(Spool&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    Spool& operator=(Spool&& other) noexcept {
+        if (this != &other) {
+            clear();
+            memory_ = std::move(other.memory_);
+            other.memory_.clear();
+            pending_ = std::move(other.pending_);
+            other.pending_.clear();
+            std::swap(fd_, other.fd_);
+            std::swap(spilled_, other.spilled_);
+            std::swap(dropped_, other.dropped_);
+            std::swap(lost_, other.lost_);
+            std::swap(spillError_, other.spillError_);
+        }
+        return *this;
+    }
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    ~Spool() {
+        clear();
+    }
+
+    bool empty() const {
+        return size() == 0 && lost_ == 0;
+    }
+
+    // Not counting anything lost
+    size_t size() const {
+        return memory_.size() + spilled_ + dropped_ + pending_.size();
+    }
+
+    void append(const char* data, size_t size) {
+        const size_t memoryBytes = keepTailOnly() ? headBytes() : limits.memoryBytes;
+        if (spilled_ == 0 && dropped_ == 0 && pending_.empty()
+                && memory_.size() < memoryBytes) {
+            const size_t room = memoryBytes - memory_.size();
+            const size_t kept = std::min(room, size);
+            memory_.append(data, kept);
+            data += kept;
+            size -= kept;
+        }
+        if (size == 0) {
+            return;
+        }
+        if (!spillError_.empty()) {
+            lost_ += size;
+            return;
+        }
+        pending_.append(data, size);
+        if (keepTailOnly()) {
+            // Trimmed in batches, so each byte is only moved a few times
+            const size_t tail = tailBytes();
+            if (pending_.size() > 2 * tail) {
+                const size_t cut = pending_.size() - tail;
+                pending_.erase(0, cut);
+                dropped_ += cut;
+            }
+        } else if (pending_.size() >= spillChunk) {
+            spill();
+        }
+    }
+
+    // What gets reported: all of it, or the head and tail if it's too long
+    std::string read() const {
+        const size_t total = size();
+        const size_t head = headBytes();
+        const size_t tail = tailBytes();
+        std::string out;
+        if (limits.shownBytes == 0 || total <= head + tail) {
+            out = range(0, total);
+        } else {
+            out = range(0, head);
+            if (!out.empty() && out.back() != '\n') {
+                out += '\n';
+            }
+            out += "... [" + std::to_string(total - head - tail)
+                + " bytes of output not shown] ...\n" + range(total - tail, tail);
+        }
+        if (lost_ > 0) {
+            if (!out.empty() && out.back() != '\n') {
+                out += '\n';
+            }
+            out += "[" + std::to_string(lost_) + " bytes lost: " + spillError_
+                + "]\n";
+        }
+        return out;
+    }
+
+    // read(), leaving the spool empty
+    std::string take() {
+        // Short output that never left memory_ is handed over as it is
+        if (spilled_ == 0 && dropped_ == 0 && lost_ == 0 && pending_.empty()
+                && (limits.shownBytes == 0
+                    || memory_.size() <= limits.shownBytes)) {
+            std::string out = std::move(memory_);
+            clear();
+            return out;
+        }
+        std::string out = read();
+        clear();
+        return out;
+    }
+
+    void clear() {
+        memory_.clear();
+        pending_.clear();
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+        spilled_ = 0;
+        dropped_ = 0;
+        lost_ = 0;
+        spillError_.clear();
+    }
+
+  private:
+    static bool keepTailOnly() {
+        return limits.discardPassing && limits.shownBytes > 0;
+    }
+
+    /* How much of the start and the end of the output read() shows, if it's
+     * cut short. With keepTailOnly() the head, and the tail window that's
+     * up to twice the tail, have to fit in memoryBytes between them.
+     */
+    static size_t headBytes() {
+        const size_t head = limits.shownBytes / 2;
+        return keepTailOnly() ? std::min(head, limits.memoryBytes / 3) : head;
+    }
+
+    static size_t tailBytes() {
+        const size_t tail = limits.shownBytes - limits.shownBytes / 2;
+        return keepTailOnly() ? std::min(tail, limits.memoryBytes / 3) : tail;
+    }
+
+    // Writes out everything staged in pending_, or if it can't, loses it
+    void spill() {
+        if (fd_ < 0) {
+            const char* dir = std::getenv("TMPDIR");
+            std::string path = std::string(dir && *dir ? dir : "/tmp")
+                + "/testframework-output-XXXXXX";
+            fd_ = mkostemp(&path[0], O_CLOEXEC);
+            if (fd_ < 0) {
+                lose("couldn't create a file to spill test output to: "
+                        + std::string(std::strerror(errno)));
+                return;
+            }
+            unlink(path.c_str());
+        }
+        size_t written = 0;
+        while (written < pending_.size()) {
+            ssize_t n = ::write(fd_, pending_.data() + written,
+                    pending_.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                pending_.erase(0, written);
+                lose("couldn't spill test output to disk: " + std::string(
+                            n < 0 ? std::strerror(errno) : "nothing written"));
+                return;
+            }
+            written += static_cast<size_t>(n);
+            spilled_ += static_cast<size_t>(n);
+        }
+        pending_.clear();
+    }
+
+    // Gives up on spilling: pending_, and everything appended after it, is
+    // only counted
+    void lose(std::string error) {
+        spillError_ = std::move(error);
+        lost_ += pending_.size();
+        pending_.clear();
+    }
+
+    // length bytes from offset, wherever they are: memory_, then the file,
+    // then what was dropped (which is never asked for), then pending_
+    std::string range(size_t offset, size_t length) const {
+        std::string out;
+        if (offset < memory_.size()) {
+            const size_t fromMemory = std::min(length, memory_.size() - offset);
+            out.append(memory_, offset, fromMemory);
+            offset += fromMemory;
+            length -= fromMemory;
+        }
+        const size_t fileEnd = memory_.size() + spilled_;
+        if (length > 0 && offset < fileEnd) {
+            const size_t fromFile = std::min(length, fileEnd - offset);
+            out += readFile(offset - memory_.size(), fromFile);
+            offset += fromFile;
+            length -= fromFile;
+        }
+        const size_t pendingStart = fileEnd + dropped_;
+        if (length > 0 && offset >= pendingStart) {
+            out.append(pending_, offset - pendingStart, length);
+        }
+        return out;
+    }
+
+    std::string readFile(size_t fileOffset, size_t length) const {
+        // mmap wants a page-aligned offset
+        const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t mapOffset = fileOffset / pageSize * pageSize;
+        const size_t mapLength = fileOffset - mapOffset + length;
+        void* map = mmap(nullptr, mapLength, PROT_READ, MAP_PRIVATE, fd_,
+                static_cast<off_t>(mapOffset));
+        if (map == MAP_FAILED) {
+            return "\n... [" + std::to_string(length)
+                + " bytes of output couldn't be read back] ...\n";
+        }
+        std::string out(static_cast<const char*>(map) + (fileOffset - mapOffset),
+                length);
+        munmap(map, mapLength);
+        return out;
+    }
+
+    std::string memory_;
+    // Staged for the file, or with keepTailOnly(), the tail
+    std::string pending_;
+    int fd_ = -1;
+    size_t spilled_ = 0;
+    // Cut from the middle with keepTailOnly()
+    size_t dropped_ = 0;
+    // Thrown away after spilling failed, and why it did
+    size_t lost_ = 0;
+    std::string spillError_;
+};
+
+} // namespace capture
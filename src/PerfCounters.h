@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Hardware performance counters around each test body and benchmark, with
+ * --perf. Every worker thread opens its own group of counters with
+ * perf_event_open (cycles, instructions, cache references and misses,
+ * branches and branch misses), counting user space only so it works at the
+ * default perf_event_paranoid of 2.
+ *
+ * Where the kernel won't hand out counters (containers, most VMs, a
+ * paranoid setting of 3) or with --perf-rusage, all there is is what
+ * getrusage knows about the thread: page faults and context switches. Those
+ * are collected either way.
+ */
+namespace perf {
+
+struct Counts {
+    // What the counts came from, from least to most detailed
+    enum Source {
+        s_none = 0,
+        s_rusage = 1,
+        s_hardware = 2,
+    };
+
+    Source source = s_none;
+
+    // Only with s_hardware
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cacheReferences = 0;
+    uint64_t cacheMisses = 0;
+    uint64_t branches = 0;
+    uint64_t branchMisses = 0;
+
+    uint64_t pageFaults = 0;
+    uint64_t contextSwitches = 0;
+
+    // Counts from the same test's other runs. Hardware counts only survive
+    // if every run had them.
+    void merge(const Counts& other) {
+        source = std::min(source, other.source);
+        cycles += other.cycles;
+        instructions += other.instructions;
+        cacheReferences += other.cacheReferences;
+        cacheMisses += other.cacheMisses;
+        branches += other.branches;
+        branchMisses += other.branchMisses;
+        pageFaults += other.pageFaults;
+        contextSwitches += other.contextSwitches;
+    }
+
+    double ipc() const {
+        return cycles ? static_cast<double>(instructions) / cycles : 0;
+    }
+
+    // As percentages
+    double cacheMissRate() const {
+        return cacheReferences ? 100.0 * cacheMisses / cacheReferences : 0;
+    }
+
+    double branchMissRate() const {
+        return branches ? 100.0 * branchMisses / branches : 0;
+    }
+};
+
+/* The calling thread's counters. Open them once per thread with
+ * forThisThread() and bracket each measurement with start() and stop().
+ */
+class ThreadCounters {
+  public:
+    explicit ThreadCounters(bool hardware) {
+        if (hardware) {
+            open();
+        }
+    }
+
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+    ~ThreadCounters() {
+        close();
+    }
+
+    // Whatever hardware says the first time a thread asks is what it gets
+    static ThreadCounters& forThisThread(bool hardware) {
+        thread_local ThreadCounters counters(hardware);
+        // A forked worker inherits the descriptors, but they'd still count
+        // the thread in the parent
+        if (counters.pid_ != getpid()) {
+            counters.close();
+            if (hardware) {
+                counters.open();
+            }
+        }
+        return counters;
+    }
+
+    void start() {
+        getrusage(RUSAGE_THREAD, &usageStart_);
+        if (leader_ >= 0) {
+            ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    Counts stop() {
+        Counts counts;
+        if (leader_ >= 0) {
+            ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            readHardware(counts);
+        }
+
+        rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        counts.pageFaults = (usage.ru_minflt - usageStart_.ru_minflt)
+            + (usage.ru_majflt - usageStart_.ru_majflt);
+        counts.contextSwitches = (usage.ru_nvcsw - usageStart_.ru_nvcsw)
+            + (usage.ru_nivcsw - usageStart_.ru_nivcsw);
+        if (counts.source == Counts::s_none) {
+            counts.source = Counts::s_rusage;
+        }
+        return counts;
+    }
+
+  private:
+    static constexpr size_t numEvents = 6;
+
+    // In the order of the fields in Counts
+    static constexpr std::pair<uint32_t, uint64_t> events[numEvents] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    // All or nothing: if any counter won't open, there are none
+    void open() {
+        pid_ = getpid();
+        for (size_t i = 0; i < numEvents; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP
+                | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr,
+                        0, -1, i == 0 ? -1 : leader_, 0));
+            if (fd < 0) {
+                close();
+                return;
+            }
+            fds_[i] = fd;
+            if (i == 0) {
+                leader_ = fd;
+            }
+        }
+    }
+
+    void close() {
+        for (int& fd : fds_) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        leader_ = -1;
+        pid_ = getpid();
+    }
+
+    void readHardware(Counts& counts) const {
+        struct {
+            uint64_t count;
+            uint64_t timeEnabled;
+            uint64_t timeRunning;
+            uint64_t values[numEvents];
+        } data;
+        if (read(leader_, &data, sizeof(data)) != sizeof(data)
+                || data.count != numEvents || data.timeRunning == 0) {
+            return;
+        }
+
+        // The kernel multiplexes groups when there are more than the PMU
+        // can count at once, so scale up to the whole time
+        const double scale =
+            static_cast<double>(data.timeEnabled) / data.timeRunning;
+        uint64_t* fields[numEvents] = {
+            &counts.cycles, &counts.instructions, &counts.cacheReferences,
+            &counts.cacheMisses, &counts.branches, &counts.branchMisses,
+        };
+        for (size_t i = 0; i < numEvents; ++i) {
+            *fields[i] = static_cast<uint64_t>(data.values[i] * scale);
+        }
+        counts.source = Counts::s_hardware;
+    }
+
+    int fds_[numEvents] = {-1, -1, -1, -1, -1, -1};
+    int leader_ = -1;
+    pid_t pid_ = getpid();
+    rusage usageStart_{};
+};
+
+} // namespace perf
@@ -1,3 +1,6 @@
+#pragma once
+
+#include <cstdio>
 #include <string>
 #include <sstream>
 #include <utility>
@@ -42,7 +45,7 @@ enum Style {
     s_underline = 4,
 };
 
-std::string decorate(
+inline std::string decorate(
         std::string&& in,
         TextColor tc = TextColor::tc_black,
         Style s = Style::s_none,
@@ -72,7 +75,7 @@ std::string decorate(
     size_t prevPtr = 0;
     for (size_t newLinePtr = in.find('\n');
             newLinePtr != std::string::npos;
-            newLinePtr = in.find(newLinePtr, '\n')) {
+            newLinePtr = in.find('\n', prevPtr)) {
         out << prefix.str() << in.substr(prevPtr, newLinePtr - prevPtr)
             << "\033[0m\n";
         prevPtr = newLinePtr + 1;
@@ -83,7 +86,7 @@ std::string decorate(
     return out.str();
 }
 
-std::string decorate(
+inline std::string decorate(
         std::string& in,
         TextColor tc = TextColor::tc_black,
         Style s = Style::s_none,
@@ -121,4 +124,50 @@ std::string yellow(T&& in) {
     return decorate(std::forward<T>(in), TextColor::tc_yellow);
 }
 
+// For writing strings into the machine readable reports
+inline std::string escapeJson(const std::string& in) {
+    std::string out;
+    out.reserve(in.size());
+    for (char c : in) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// XML 1.0 can't hold most control characters at all, even escaped, so
+// they're dropped. That includes the ANSI color codes.
+inline std::string escapeXml(const std::string& in) {
+    std::string out;
+    out.reserve(in.size());
+    for (char c : in) {
+        switch (c) {
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '&': out += "&amp;"; break;
+            case '"': out += "&quot;"; break;
+            case '\'': out += "&apos;"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20
+                        || c == '\n' || c == '\t' || c == '\r') {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
 } // namespace print
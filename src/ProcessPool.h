@@ -0,0 +1,524 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "OutputSpool.h"
+#include "StackDump.h"
+#include "TestResult.h"
+#include "Timing.h"
+
+/* Runs tasks in forked worker processes so a test that segfaults, aborts or
+ * calls exit() only takes down its worker instead of the whole run.
+ *
+ * Workers are forked once up front and then reused, one task after another.
+ * The parent talks to each worker over three pipes besides the one it sends
+ * task numbers down:
+ *   - results: one length-prefixed record per finished task
+ *   - stdout and stderr: the worker's own fds 1 and 2, so printf and
+ *     anything else that writes straight to the fds is captured too
+ * The parent polls all of them at once, so a chatty worker never blocks on a
+ * full pipe. When a worker dies mid-task, its task is reported as crashed
+ * with whatever output made it through, and a fresh worker is forked in its
+ * place.
+ *
+ * A task that runs past its timeout is sent SIGUSR2, which makes the worker
+ * write its stack to stderr and exit (see StackDump.h), and SIGKILL if it's
+ * still there half a second later. It's reported as timed out.
+ *
+ * The parent must not have any other threads running while the pool is in
+ * use, since it forks replacements as it goes. The one exception is the
+ * metrics exporter (see Telemetry.h), which keeps out of the way of forks.
+ */
+class ProcessPool {
+  public:
+    typedef std::function<TestResult(size_t task)> ChildFunc;
+    typedef std::function<void(size_t task, TestResult&& result)> ResultFunc;
+    typedef std::function<void(size_t task, size_t worker)> StartFunc;
+    // Milliseconds a task may run, 0 for no limit
+    typedef std::function<double(size_t task)> TimeoutFunc;
+
+    ProcessPool(size_t numWorkers, ChildFunc childFunc,
+            TimeoutFunc timeoutMs = nullptr, bool dumpStacks = false)
+        : numWorkers_(numWorkers),
+          childFunc_(std::move(childFunc)),
+          timeoutMs_(std::move(timeoutMs)),
+          dumpStacks_(dumpStacks) {
+    }
+
+    // Runs tasks in the order given and calls onResult in the parent as each
+    // one finishes, and onStart (if given) as each is handed to a worker
+    void run(const std::vector<size_t>& order, const ResultFunc& onResult,
+            const StartFunc& onStart = nullptr) {
+        if (order.empty()) {
+            return;
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        auto oldSigpipe = std::signal(SIGPIPE, SIG_IGN);
+
+        std::deque<size_t> pending(order.begin(), order.end());
+        workers_.resize(std::min(numWorkers_, order.size()));
+        for (auto& worker : workers_) {
+            spawn(worker);
+        }
+
+        size_t busy = 0;
+        stopping_ = false;
+        while (!pending.empty() || busy > 0) {
+            if (stopping_) {
+                pending.clear();
+            }
+
+            for (size_t w = 0; w < workers_.size(); ++w) {
+                Worker& worker = workers_[w];
+                while (!worker.busy && !pending.empty()) {
+                    uint32_t task = static_cast<uint32_t>(pending.front());
+                    if (worker.pid < 0
+                            || !writeAll(worker.requestFd, &task, sizeof(task))) {
+                        // Died while idle. Replace it and try again.
+                        reap(worker);
+                        spawn(worker);
+                        continue;
+                    }
+                    pending.pop_front();
+                    worker.busy = true;
+                    worker.task = task;
+                    worker.startMs = timing::steadyMs();
+                    worker.timeoutMs = timeoutMs_ ? timeoutMs_(task) : 0;
+                    ++busy;
+                    if (onStart) {
+                        onStart(task, w);
+                    }
+                }
+            }
+
+            std::vector<pollfd> fds;
+            for (auto& worker : workers_) {
+                for (int fd : {worker.resultFd, worker.outFd, worker.errFd}) {
+                    fds.push_back(pollfd{fd, POLLIN, 0});
+                }
+            }
+            if (poll(fds.data(), fds.size(), pollTimeout()) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(
+                        std::string("poll failed: ") + std::strerror(errno));
+            }
+
+            for (size_t i = 0; i < workers_.size(); ++i) {
+                Worker& worker = workers_[i];
+                if (fds[i * 3 + 1].revents) {
+                    drain(worker.outFd, worker.out);
+                }
+                if (fds[i * 3 + 2].revents) {
+                    drain(worker.errFd, worker.err);
+                }
+                if (fds[i * 3].revents && !readResults(worker, onResult, busy)) {
+                    // EOF on the results pipe: the worker is gone
+                    reap(worker);
+                    if (worker.busy) {
+                        worker.busy = false;
+                        --busy;
+                        TestResult result;
+                        if (worker.killAtMs > 0) {
+                            result.fail(TestResult::s_timedOut,
+                                    TestResult::describeTimeout(worker.timeoutMs));
+                        } else {
+                            result.fail(TestResult::s_crashed,
+                                    describeExit(worker.exitStatus));
+                        }
+                        result.startMs = worker.startMs;
+                        result.endMs = timing::steadyMs();
+                        result.wallMs = result.endMs - result.startMs;
+                        result.out = worker.out.take();
+                        result.err = worker.err.take();
+                        onResult(worker.task, std::move(result));
+                    }
+                    if (!pending.empty()) {
+                        spawn(worker);
+                    }
+                }
+            }
+            // Workers that were reaped above and not replaced have fd -1,
+            // which poll ignores
+
+            enforceTimeouts();
+        }
+
+        for (auto& worker : workers_) {
+            if (worker.pid > 0) {
+                close(worker.requestFd);
+                reap(worker);
+            }
+        }
+        workers_.clear();
+        std::signal(SIGPIPE, oldSigpipe);
+    }
+
+    // Called from onResult to skip every task that hasn't been started yet
+    void stop() {
+        stopping_ = true;
+    }
+
+  private:
+    struct Worker {
+        pid_t pid = -1;
+        int requestFd = -1;
+        int resultFd = -1;
+        int outFd = -1;
+        int errFd = -1;
+        bool busy = false;
+        size_t task = 0;
+        double startMs = 0;
+        double timeoutMs = 0;
+        // Once the task has timed out: when to SIGKILL the worker if the
+        // stack dump hasn't made it exit by then
+        double killAtMs = 0;
+        int exitStatus = 0;
+        std::string pendingResult;
+        capture::Spool out;
+        capture::Spool err;
+    };
+
+    void spawn(Worker& worker) {
+        int request[2], result[2], out[2], err[2];
+        if (pipe(request) || pipe(result) || pipe(out) || pipe(err)) {
+            throw std::runtime_error(
+                    std::string("pipe failed: ") + std::strerror(errno));
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error(
+                    std::string("fork failed: ") + std::strerror(errno));
+        }
+
+        if (pid == 0) {
+            // The child must not hold other workers' pipes open, or the
+            // parent would never see EOF when one of them dies
+            for (auto& other : workers_) {
+                for (int fd : {other.requestFd, other.resultFd,
+                        other.outFd, other.errFd}) {
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                }
+            }
+            close(request[1]);
+            close(result[0]);
+            close(out[0]);
+            close(err[0]);
+            dup2(out[1], STDOUT_FILENO);
+            dup2(err[1], STDERR_FILENO);
+            close(out[1]);
+            close(err[1]);
+            // Line buffered so a crash loses at most a partial line
+            std::setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+            childLoop(request[0], result[1]);
+        }
+
+        close(request[0]);
+        close(result[1]);
+        close(out[1]);
+        close(err[1]);
+        worker = Worker();
+        worker.pid = pid;
+        worker.requestFd = request[1];
+        worker.resultFd = result[0];
+        worker.outFd = out[0];
+        worker.errFd = err[0];
+        for (int fd : {worker.resultFd, worker.outFd, worker.errFd}) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    // Milliseconds until the next deadline, or -1 for none
+    int pollTimeout() const {
+        double wait = -1;
+        const double now = timing::steadyMs();
+        for (const auto& worker : workers_) {
+            double deadline = worker.killAtMs > 0 ? worker.killAtMs
+                : worker.timeoutMs > 0 ? worker.startMs + worker.timeoutMs
+                : -1;
+            if (worker.busy && worker.pid > 0 && deadline >= 0) {
+                double left = std::max(0.0, deadline - now);
+                wait = wait < 0 ? left : std::min(wait, left);
+            }
+        }
+        return wait < 0 ? -1 : static_cast<int>(wait) + 1;
+    }
+
+    // The worker's death is then picked up like any other crash
+    void enforceTimeouts() {
+        const double now = timing::steadyMs();
+        for (auto& worker : workers_) {
+            if (!worker.busy || worker.pid <= 0 || worker.timeoutMs <= 0) {
+                continue;
+            }
+            if (worker.killAtMs == 0
+                    && now - worker.startMs > worker.timeoutMs) {
+                worker.killAtMs = now + (dumpStacks_ ? 500 : 0);
+                kill(worker.pid, dumpStacks_ ? stackdump::dumpSignal : SIGKILL);
+            } else if (worker.killAtMs > 0 && now >= worker.killAtMs) {
+                kill(worker.pid, SIGKILL);
+            }
+        }
+    }
+
+    [[noreturn]] void childLoop(int requestFd, int resultFd) {
+        if (dumpStacks_) {
+            stackdump::install(true);
+        }
+        uint32_t task;
+        while (readAll(requestFd, &task, sizeof(task))) {
+            TestResult result = childFunc_(task);
+            std::cout.flush();
+            std::cerr.flush();
+            std::fflush(nullptr);
+            std::string record = serialize(result);
+            if (!writeAll(resultFd, record.data(), record.size())) {
+                break;
+            }
+        }
+        std::fflush(nullptr);
+        _exit(0);
+    }
+
+    // Returns false once the results pipe hits EOF
+    bool readResults(Worker& worker, const ResultFunc& onResult, size_t& busy) {
+        bool open = drain(worker.resultFd, worker.pendingResult);
+
+        uint32_t length;
+        while (worker.pendingResult.size() >= sizeof(length)) {
+            std::memcpy(&length, worker.pendingResult.data(), sizeof(length));
+            if (worker.pendingResult.size() < sizeof(length) + length) {
+                break;
+            }
+
+            TestResult result = deserialize(
+                    worker.pendingResult.substr(sizeof(length), length));
+            worker.pendingResult.erase(0, sizeof(length) + length);
+
+            // The worker flushes its output before sending the result, so
+            // everything it printed for this task is already in the pipes
+            drain(worker.outFd, worker.out);
+            drain(worker.errFd, worker.err);
+            if (result.status == TestResult::s_passed
+                    && capture::limits.discardPassing) {
+                worker.out.clear();
+                worker.err.clear();
+            }
+            result.out = worker.out.take();
+            result.err = worker.err.take();
+            worker.busy = false;
+            --busy;
+            onResult(worker.task, std::move(result));
+        }
+
+        return open;
+    }
+
+    void reap(Worker& worker) {
+        if (worker.pid > 0) {
+            while (waitpid(worker.pid, &worker.exitStatus, 0) < 0
+                    && errno == EINTR) {
+            }
+        }
+        drain(worker.outFd, worker.out);
+        drain(worker.errFd, worker.err);
+        for (int* fd : {&worker.requestFd, &worker.resultFd,
+                &worker.outFd, &worker.errFd}) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        worker.pid = -1;
+    }
+
+    static std::string describeExit(int status) {
+        if (WIFSIGNALED(status)) {
+            int sig = WTERMSIG(status);
+            return "crashed with signal " + std::to_string(sig)
+                + " (" + strsignal(sig) + ")";
+        }
+        return "exited with status " + std::to_string(WEXITSTATUS(status))
+            + " during the test";
+    }
+
+    // Reads whatever is available without blocking into a std::string or a
+    // capture::Spool. Returns false on EOF.
+    template <typename Buffer>
+    static bool drain(int fd, Buffer& into) {
+        if (fd < 0) {
+            return false;
+        }
+
+        char buf[65536];
+        while (true) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                into.append(buf, static_cast<size_t>(n));
+            } else if (n == 0) {
+                return false;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+    }
+
+    static bool readAll(int fd, void* data, size_t size) {
+        char* ptr = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t n = read(fd, ptr, size);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            ptr += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool writeAll(int fd, const void* data, size_t size) {
+        const char* ptr = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = write(fd, ptr, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            ptr += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Output travels over its own pipes, so only the rest goes in the record
+    static std::string serialize(const TestResult& result) {
+        std::string payload;
+        payload.push_back(static_cast<char>(result.status));
+        appendPod(payload, result.wallMs);
+        appendPod(payload, result.cpuMs);
+        appendPod(payload, result.startMs);
+        appendPod(payload, result.endMs);
+        appendPod(payload, static_cast<uint64_t>(result.runs));
+        appendPod(payload, static_cast<uint64_t>(result.failedRuns));
+        appendPod(payload, static_cast<uint64_t>(result.allocations));
+        appendPod(payload, static_cast<uint64_t>(result.allocatedBytes));
+        appendPod(payload, static_cast<uint64_t>(result.peakBytes));
+        appendPod(payload, static_cast<uint64_t>(result.leakedBytes));
+        appendPod(payload, result.counters);
+        appendPod(payload, result.durationBuckets);
+        appendPod(payload, static_cast<uint32_t>(result.threadOps.size()));
+        for (const auto& thread : result.threadOps) {
+            appendPod(payload, thread);
+        }
+        appendString(payload, result.failure);
+        appendPod(payload, static_cast<uint32_t>(result.failureCounts.size()));
+        for (const auto& entry : result.failureCounts) {
+            appendString(payload, entry.first);
+            appendPod(payload, static_cast<uint64_t>(entry.second));
+        }
+
+        std::string record;
+        appendPod(record, static_cast<uint32_t>(payload.size()));
+        return record + payload;
+    }
+
+    static TestResult deserialize(const std::string& payload) {
+        TestResult result;
+        size_t pos = 0;
+        result.status = static_cast<TestResult::Status>(payload[pos++]);
+        readPod(payload, pos, result.wallMs);
+        readPod(payload, pos, result.cpuMs);
+        readPod(payload, pos, result.startMs);
+        readPod(payload, pos, result.endMs);
+        uint64_t count;
+        readPod(payload, pos, count);
+        result.runs = static_cast<size_t>(count);
+        readPod(payload, pos, count);
+        result.failedRuns = static_cast<size_t>(count);
+        readPod(payload, pos, count);
+        result.allocations = static_cast<size_t>(count);
+        readPod(payload, pos, count);
+        result.allocatedBytes = static_cast<size_t>(count);
+        readPod(payload, pos, count);
+        result.peakBytes = static_cast<size_t>(count);
+        readPod(payload, pos, count);
+        result.leakedBytes = static_cast<size_t>(count);
+        readPod(payload, pos, result.counters);
+        readPod(payload, pos, result.durationBuckets);
+        uint32_t numThreads;
+        readPod(payload, pos, numThreads);
+        result.threadOps.resize(numThreads);
+        for (auto& thread : result.threadOps) {
+            readPod(payload, pos, thread);
+        }
+        result.failure = readString(payload, pos);
+        uint32_t numMessages;
+        readPod(payload, pos, numMessages);
+        for (uint32_t i = 0; i < numMessages; ++i) {
+            std::string message = readString(payload, pos);
+            readPod(payload, pos, count);
+            result.failureCounts[std::move(message)] = static_cast<size_t>(count);
+        }
+        return result;
+    }
+
+    static void appendString(std::string& out, const std::string& value) {
+        appendPod(out, static_cast<uint32_t>(value.size()));
+        out += value;
+    }
+
+    static std::string readString(const std::string& in, size_t& pos) {
+        uint32_t size;
+        readPod(in, pos, size);
+        std::string value = in.substr(pos, size);
+        pos += size;
+        return value;
+    }
+
+    template <typename T>
+    static void appendPod(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void readPod(const std::string& in, size_t& pos, T& value) {
+        std::memcpy(&value, in.data() + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+
+    size_t numWorkers_;
+    ChildFunc childFunc_;
+    TimeoutFunc timeoutMs_;
+    bool dumpStacks_;
+    std::vector<Worker> workers_;
+    bool stopping_ = false;
+};
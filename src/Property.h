@@ -0,0 +1,332 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Assert.h"
+#include "TestRegistry.h"
+
+/* Parameterized tests. TEST_P runs its body once per value from a source,
+ * and each value is a separate case: the runner spreads the cases over the
+ * worker threads like the runs of a repeated test, and every case runs (and
+ * is counted) even after one fails.
+ *
+ *     TEST_P("IsPrime", int n, test::values(2, 3, 5, 7, 11)) {
+ *         ASSERT_TRUE(isPrime(n));
+ *     }
+ *
+ * PROPERTY is the same thing with a generator as the source. Every case gets
+ * a value drawn from the run's seed, and a case that fails is shrunk: the
+ * body is run again on simpler and simpler values for as long as it keeps
+ * failing, and the smallest failing value is reported along with the seed.
+ * --seed reruns with the same values. A PROPERTY has 100 cases unless
+ * test::cases says otherwise.
+ *
+ *     PROPERTY("ReverseTwice", std::vector<int> v,
+ *             test::vectors(test::ints(-100, 100)), test::cases(500)) {
+ *         ASSERT_EQ(reverse(reverse(v)), v);
+ *     }
+ *
+ * Any type with these members can be a source:
+ *
+ *     typedef T value_type;
+ *     size_t cases() const;             // 0 means as many as test::cases says
+ *     T generate(test::Random& random, size_t index) const;
+ *     std::vector<T> shrink(const T& value) const;  // simpler values first
+ */
+namespace test {
+
+// splitmix64. Small, fast, and good enough to pick test inputs.
+class Random {
+  public:
+    explicit Random(uint64_t seed) : state_(seed) {
+    }
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [low, high]
+    template <typename T>
+    T between(T low, T high) {
+        typedef std::make_unsigned_t<T> U;
+        const uint64_t span = static_cast<uint64_t>(
+                static_cast<U>(high) - static_cast<U>(low)) + 1;
+        const uint64_t offset = span == 0 ? next() : next() % span;
+        return static_cast<T>(static_cast<U>(low) + static_cast<U>(offset));
+    }
+
+    // Each case gets its own stream, so its value doesn't depend on which
+    // worker ran it or in what order
+    static Random forCase(uint64_t seed, size_t index) {
+        Random mixer(seed ^ (0xd1b54a32d192ed03ULL * (index + 1)));
+        return Random(mixer.next());
+    }
+
+  private:
+    uint64_t state_;
+};
+
+// The given values, one case each, never shrunk
+template <typename T>
+struct Values {
+    typedef T value_type;
+
+    size_t cases() const {
+        return values.size();
+    }
+
+    T generate(Random&, size_t index) const {
+        return values[index % values.size()];
+    }
+
+    std::vector<T> shrink(const T&) const {
+        return {};
+    }
+
+    std::vector<T> values;
+};
+
+template <typename T, typename... Rest>
+Values<T> values(T first, Rest... rest) {
+    return Values<T>{{first, static_cast<T>(rest)...}};
+}
+
+// Integers in [low, high], shrunk toward 0 (or the end of the range closest
+// to it)
+template <typename T>
+struct Ints {
+    static_assert(std::is_integral_v<T>, "test::ints needs an integer type");
+    typedef T value_type;
+
+    size_t cases() const {
+        return 0;
+    }
+
+    T generate(Random& random, size_t) const {
+        return random.between(low, high);
+    }
+
+    // The target, then halfway there, a quarter of the way, ..., one step
+    std::vector<T> shrink(const T& value) const {
+        const T target = low > 0 ? low : high < 0 ? high : T(0);
+        std::vector<T> simpler;
+        if (value == target) {
+            return simpler;
+        }
+        simpler.push_back(target);
+        for (T distance = (value - target) / 2; distance != 0; distance /= 2) {
+            simpler.push_back(value - distance);
+        }
+        return simpler;
+    }
+
+    T low;
+    T high;
+};
+
+template <typename T>
+Ints<T> ints(T low, T high) {
+    return Ints<T>{low, high};
+}
+
+template <typename T = int>
+Ints<T> ints() {
+    return Ints<T>{std::numeric_limits<T>::min(), std::numeric_limits<T>::max()};
+}
+
+/* Vectors of up to maxSize elements from another generator. Shrinking drops
+ * elements first (all of them, then half, then one at a time) and then
+ * shrinks the elements that are left.
+ */
+template <typename Element>
+struct Vectors {
+    typedef typename Element::value_type Item;
+    typedef std::vector<Item> value_type;
+
+    size_t cases() const {
+        return 0;
+    }
+
+    value_type generate(Random& random, size_t index) const {
+        value_type value(random.between<size_t>(0, maxSize));
+        for (auto& item : value) {
+            item = element.generate(random, index);
+        }
+        return value;
+    }
+
+    std::vector<value_type> shrink(const value_type& value) const {
+        std::vector<value_type> simpler;
+        if (value.empty()) {
+            return simpler;
+        }
+        simpler.emplace_back();
+        const size_t half = value.size() / 2;
+        if (half > 0) {
+            simpler.emplace_back(value.begin(), value.begin() + half);
+            simpler.emplace_back(value.begin() + half, value.end());
+        }
+        for (size_t i = 0; i < value.size() && value.size() > 1; ++i) {
+            simpler.push_back(value);
+            simpler.back().erase(simpler.back().begin() + i);
+        }
+        for (size_t i = 0; i < value.size(); ++i) {
+            for (auto& item : element.shrink(value[i])) {
+                simpler.push_back(value);
+                simpler.back()[i] = std::move(item);
+            }
+        }
+        return simpler;
+    }
+
+    Element element;
+    size_t maxSize;
+};
+
+template <typename Element>
+Vectors<Element> vectors(Element element, size_t maxSize = 16) {
+    return Vectors<Element>{std::move(element), maxSize};
+}
+
+namespace detail {
+
+template <typename T, typename = void>
+struct isPrintableRange : std::false_type {};
+
+template <typename T>
+struct isPrintableRange<T, std::void_t<decltype(std::declval<const T&>().begin())>>
+    : assert::isPrintable<typename T::value_type> {};
+
+// For the failure message. Empty if the value can't be printed.
+template <typename T>
+std::string describe(const T& value) {
+    std::ostringstream out;
+    if constexpr (assert::isPrintable<T>::value) {
+        out << value;
+    } else if constexpr (isPrintableRange<T>::value) {
+        out << '[';
+        const char* separator = "";
+        for (const auto& item : value) {
+            out << separator << item;
+            separator = ", ";
+        }
+        out << ']';
+    }
+    return out.str();
+}
+
+// True if the body fails on value, with its failure message. A failed
+// EXPECT_* counts, so those cases get shrunk too.
+template <typename Body, typename T>
+bool fails(Body body, const T& value, std::string& message) {
+    try {
+        body(value);
+    } catch (assert::assertion_error& e) {
+        message = assert::takeExpectFailures_();
+        message += (message.empty() ? "" : "\n    ") + std::string(e.what());
+        return true;
+    } catch (std::exception& e) {
+        message = assert::takeExpectFailures_();
+        message += (message.empty() ? "" : "\n    ")
+            + std::string("failed with exception: ") + e.what();
+        return true;
+    }
+    message = assert::takeExpectFailures_();
+    return !message.empty();
+}
+
+// For generators, unless the test says otherwise with test::cases
+constexpr size_t defaultCases = 100;
+
+constexpr size_t maxShrinkAttempts = 1000;
+
+/* Runs case index of a TEST_P. If it fails, looks for the simplest value
+ * that still fails, and throws that failure with the value and seed added.
+ */
+template <typename Source, typename Param>
+void runCase(const Source& source, void (*body)(Param),
+        size_t index, uint64_t seed) {
+    typedef typename Source::value_type T;
+    Random random = Random::forCase(seed, index);
+    const T original = source.generate(random, index);
+
+    std::string message;
+    if (!fails(body, original, message)) {
+        return;
+    }
+
+    T smallest = original;
+    size_t attempts = 0;
+    bool shrunk = true;
+    while (shrunk && attempts < maxShrinkAttempts) {
+        shrunk = false;
+        for (const T& candidate : source.shrink(smallest)) {
+            if (++attempts > maxShrinkAttempts) {
+                break;
+            }
+            std::string candidateMessage;
+            if (fails(body, candidate, candidateMessage)) {
+                smallest = candidate;
+                message = std::move(candidateMessage);
+                shrunk = true;
+                break;
+            }
+        }
+    }
+
+    // Nothing about the case itself, so cases that shrink to the same value
+    // are counted as one failure
+    std::string value = describe(smallest);
+    if (source.cases() > 0) {
+        message += "\n    Parameter: " + (value.empty() ? "?" : value);
+    } else {
+        message += "\n    Counterexample: " + (value.empty() ? "?" : value)
+            + " (seed " + std::to_string(seed) + ")";
+    }
+    throw assert::assertion_error(message);
+}
+
+// Reads the source's case count and then applies the annotations that came
+// after it in TEST_P(...)
+template <typename Source, typename... Annotations>
+struct parameterized {
+    parameterized(caseFunc func, const Source& source,
+            const Annotations&... annotations)
+        : func_(func), cases_(source.cases()), annotations_(annotations...) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.runCase = func_;
+        std::apply([&test](const auto&... annotation) {
+            (annotation.apply(test), ...);
+        }, annotations_);
+        if (test.numCases == 0) {
+            test.numCases = cases_ ? cases_ : defaultCases;
+        }
+    }
+
+  private:
+    caseFunc func_;
+    size_t cases_;
+    std::tuple<Annotations...> annotations_;
+};
+
+template <typename Source, typename... Annotations>
+const Source& firstOf(const Source& source, const Annotations&...) {
+    return source;
+}
+
+} // namespace detail
+
+} // namespace test
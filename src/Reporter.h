@@ -0,0 +1,622 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PrintHelpers.h"
+#include "TestResult.h"
+#include "Timing.h"
+#include "Trace.h"
+
+// A finished test, as handed to the reporter
+struct TestReport {
+    std::string name;
+    const char* file;
+    int line;
+    // Report run counts and throughput (the test was run more than once)
+    bool repeated;
+    // A TEST_P, whose runs are its cases
+    bool parameterized;
+    TestResult result;
+};
+
+struct RunSummary {
+    size_t numTests = 0;
+    size_t numPassed = 0;
+    size_t numSkipped = 0;
+    // Sorted by name
+    std::vector<std::string> failed;
+    // Sorted by name. Not in failed.
+    std::vector<std::string> timedOut;
+    double wallMs = 0;
+};
+
+/* One output format. Sinks are only ever called from the reporter's writer
+ * thread, so they don't need any locking of their own. They append to a
+ * buffer and write it out in flush(), which the writer calls once per batch
+ * of events instead of once per line.
+ */
+class ReportSink {
+  public:
+    virtual ~ReportSink() = default;
+    virtual void runStarted(size_t numTests) = 0;
+    virtual void testFinished(const TestReport& report) = 0;
+    virtual void runFinished(const RunSummary& summary) = 0;
+    virtual void flush() = 0;
+};
+
+// The colored, human readable output on stdout
+class ConsoleSink : public ReportSink {
+  public:
+    // With showAllocs, each test gets a line of allocation counts (--allocs),
+    // and with showPerf its counters (--perf)
+    explicit ConsoleSink(bool showAllocs = false, bool showPerf = false)
+        : showAllocs_(showAllocs), showPerf_(showPerf) {
+    }
+
+    void runStarted(size_t numTests) override {
+        line("Executing " + std::to_string(numTests) + " tests:");
+    }
+
+    void testFinished(const TestReport& report) override {
+        const TestResult& result = report.result;
+        const char* runs = report.parameterized ? " cases" : " runs";
+        std::string throughput;
+        if (report.repeated && !report.parameterized) {
+            char stats[64];
+            std::snprintf(stats, sizeof(stats), ", %.0f runs/s",
+                    result.wallMs > 0 ? result.runs * 1000.0 / result.wallMs : 0.0);
+            throughput = stats;
+        }
+
+        if (result.status == TestResult::s_passed) {
+            line(print::green(report.name
+                + std::string("...OK")
+                + (report.repeated
+                    ? " (" + std::to_string(result.runs) + runs
+                        + throughput + ")"
+                    : std::string())));
+        } else if (result.status == TestResult::s_timedOut) {
+            line(print::red(report.name + std::string("...TIMED OUT")));
+            line(print::red(std::string("    ") + result.failure));
+        } else if (!report.repeated) {
+            line(print::red(report.name + std::string("...")));
+            line(print::red(std::string("    ") + result.failure));
+        } else {
+            char rate[64];
+            std::snprintf(rate, sizeof(rate), " (%.2f%%)",
+                    100.0 * result.failedRuns / result.runs);
+            line(print::red(report.name + std::string("...")));
+            line(print::red(std::string("    failed ")
+                + std::to_string(result.failedRuns) + " of "
+                + std::to_string(result.runs) + runs + rate + throughput));
+            for (const auto& entry : result.failureCounts) {
+                line(print::red(std::string("    ")
+                    + std::to_string(entry.second) + "x " + entry.first));
+            }
+        }
+
+        if (showAllocs_) {
+            line("    " + std::to_string(result.allocations) + " allocations, "
+                + std::to_string(result.allocatedBytes) + " bytes, peak "
+                + std::to_string(result.peakBytes) + " bytes");
+            if (result.leakedBytes > 0) {
+                line(print::yellow("    leaked "
+                    + std::to_string(result.leakedBytes) + " bytes"));
+            }
+        }
+
+        if (!result.threadOps.empty()) {
+            printThroughput(result.threadOps);
+        }
+
+        if (showPerf_) {
+            printCounters(result.counters);
+        }
+
+        if (!result.out.empty()) {
+            line(print::yellow("------Test Stdout-------"));
+            line(result.out);
+            line(print::yellow("------------------------"));
+        }
+
+        if (!result.err.empty()) {
+            line(print::yellow("------Test Stderr-------"));
+            line(result.err);
+            line(print::yellow("------------------------"));
+        }
+    }
+
+    void runFinished(const RunSummary& summary) override {
+        buffer_ += '\n';
+        if (summary.numPassed == summary.numTests) {
+            line(print::boldGreen(std::string("All ")
+                + std::to_string(summary.numTests)
+                + std::string(" tests passed!")));
+        } else {
+            std::string result = std::to_string(summary.numPassed)
+                + std::string(" of ")
+                + std::to_string(summary.numTests)
+                + std::string(" tests passed.");
+            line(summary.numPassed > 0
+                ? print::boldYellow(result)
+                : print::boldRed(result));
+        }
+        if (summary.numSkipped > 0) {
+            line("Stopped after the first failure; "
+                + std::to_string(summary.numSkipped)
+                + " tests were skipped.");
+        }
+        if (!summary.failed.empty()) {
+            line("The following tests failed:");
+            for (const auto& name : summary.failed) {
+                line(print::red(std::string("    ") + name));
+            }
+        }
+        if (!summary.timedOut.empty()) {
+            line("The following tests timed out:");
+            for (const auto& name : summary.timedOut) {
+                line(print::red(std::string("    ") + name));
+            }
+        }
+    }
+
+    void flush() override {
+        if (!buffer_.empty()) {
+            std::cout.write(buffer_.data(), buffer_.size());
+            std::cout.flush();
+            buffer_.clear();
+        }
+    }
+
+  private:
+    void line(const std::string& text) {
+        buffer_ += text;
+        buffer_ += '\n';
+    }
+
+    // For a TEST_CONCURRENT that counted its operations. The total is over
+    // the time the slowest thread took.
+    void printThroughput(const std::vector<TestResult::ThreadOps>& threads) {
+        uint64_t ops = 0;
+        double slowestMs = 0;
+        double minRate = -1;
+        double maxRate = 0;
+        for (const auto& thread : threads) {
+            ops += thread.ops;
+            slowestMs = std::max(slowestMs, thread.ms);
+            const double rate = thread.ms > 0 ? thread.ops * 1000.0 / thread.ms : 0;
+            minRate = minRate < 0 ? rate : std::min(minRate, rate);
+            maxRate = std::max(maxRate, rate);
+        }
+        if (ops == 0) {
+            return;
+        }
+        char text[160];
+        std::snprintf(text, sizeof(text),
+                "    %zu threads: %.0f ops/s in total, %.0f to %.0f ops/s per thread",
+                threads.size(), slowestMs > 0 ? ops * 1000.0 / slowestMs : 0.0,
+                minRate, maxRate);
+        line(text);
+    }
+
+    void printCounters(const perf::Counts& counts) {
+        char text[160];
+        if (counts.source == perf::Counts::s_hardware) {
+            std::snprintf(text, sizeof(text),
+                    "    IPC %.2f, cache misses %.2f%%, branch misses %.2f%%"
+                    " (%llu cycles)",
+                    counts.ipc(), counts.cacheMissRate(), counts.branchMissRate(),
+                    static_cast<unsigned long long>(counts.cycles));
+            line(text);
+        }
+        if (counts.source != perf::Counts::s_none) {
+            std::snprintf(text, sizeof(text),
+                    "    %llu page faults, %llu context switches",
+                    static_cast<unsigned long long>(counts.pageFaults),
+                    static_cast<unsigned long long>(counts.contextSwitches));
+            line(text);
+        }
+    }
+
+    bool showAllocs_;
+    bool showPerf_;
+    std::string buffer_;
+};
+
+// One JSON object per line: a line per test, then one with the summary
+class JsonLinesSink : public ReportSink {
+  public:
+    explicit JsonLinesSink(const std::string& path)
+        : out_(path, std::ios::trunc) {
+        if (!out_) {
+            throw std::runtime_error("Couldn't open " + path + " for writing");
+        }
+    }
+
+    void runStarted(size_t) override {
+    }
+
+    void testFinished(const TestReport& report) override {
+        const TestResult& result = report.result;
+        char numbers[320];
+        std::snprintf(numbers, sizeof(numbers),
+                "\"runs\": %zu, \"failed_runs\": %zu, "
+                "\"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+                "\"allocations\": %zu, \"allocated_bytes\": %zu, "
+                "\"peak_bytes\": %zu, \"leaked_bytes\": %zu",
+                result.runs, result.failedRuns, result.wallMs, result.cpuMs,
+                result.allocations, result.allocatedBytes,
+                result.peakBytes, result.leakedBytes);
+        buffer_ += "{\"name\": \"" + print::escapeJson(report.name)
+            + "\", \"file\": \"" + print::escapeJson(report.file)
+            + "\", \"line\": " + std::to_string(report.line)
+            + ", \"status\": \"" + statusName(result.status) + "\", "
+            + numbers + counters(result.counters)
+            + threadThroughput(result.threadOps)
+            + ", \"failure\": \"" + print::escapeJson(result.failure)
+            + "\", \"stdout\": \"" + print::escapeJson(result.out)
+            + "\", \"stderr\": \"" + print::escapeJson(result.err)
+            + "\"}\n";
+    }
+
+    void runFinished(const RunSummary& summary) override {
+        char numbers[160];
+        std::snprintf(numbers, sizeof(numbers),
+                "\"tests\": %zu, \"passed\": %zu, \"failed\": %zu, "
+                "\"timed_out\": %zu, \"skipped\": %zu, \"wall_ms\": %.3f",
+                summary.numTests, summary.numPassed, summary.failed.size(),
+                summary.timedOut.size(), summary.numSkipped, summary.wallMs);
+        buffer_ += std::string("{\"summary\": {") + numbers + "}}\n";
+    }
+
+    void flush() override {
+        out_.write(buffer_.data(), buffer_.size());
+        out_.flush();
+        buffer_.clear();
+    }
+
+    // Empty unless it's a TEST_CONCURRENT
+    static std::string threadThroughput(
+            const std::vector<TestResult::ThreadOps>& threads) {
+        if (threads.empty()) {
+            return "";
+        }
+        std::string json = ", \"thread_ops\": [";
+        std::string rates = ", \"thread_ops_per_sec\": [";
+        for (size_t i = 0; i < threads.size(); ++i) {
+            char rate[32];
+            std::snprintf(rate, sizeof(rate), "%.1f", threads[i].ms > 0
+                    ? threads[i].ops * 1000.0 / threads[i].ms : 0.0);
+            json += (i ? ", " : "") + std::to_string(threads[i].ops);
+            rates += (i ? ", " : "") + std::string(rate);
+        }
+        return json + "]" + rates + "]";
+    }
+
+    // Empty unless the test ran with --perf
+    static std::string counters(const perf::Counts& counts) {
+        char numbers[320];
+        if (counts.source == perf::Counts::s_hardware) {
+            std::snprintf(numbers, sizeof(numbers),
+                    ", \"cycles\": %llu, \"instructions\": %llu, "
+                    "\"cache_references\": %llu, \"cache_misses\": %llu, "
+                    "\"branches\": %llu, \"branch_misses\": %llu, "
+                    "\"ipc\": %.3f, \"page_faults\": %llu, "
+                    "\"context_switches\": %llu",
+                    static_cast<unsigned long long>(counts.cycles),
+                    static_cast<unsigned long long>(counts.instructions),
+                    static_cast<unsigned long long>(counts.cacheReferences),
+                    static_cast<unsigned long long>(counts.cacheMisses),
+                    static_cast<unsigned long long>(counts.branches),
+                    static_cast<unsigned long long>(counts.branchMisses),
+                    counts.ipc(),
+                    static_cast<unsigned long long>(counts.pageFaults),
+                    static_cast<unsigned long long>(counts.contextSwitches));
+        } else if (counts.source == perf::Counts::s_rusage) {
+            std::snprintf(numbers, sizeof(numbers),
+                    ", \"page_faults\": %llu, \"context_switches\": %llu",
+                    static_cast<unsigned long long>(counts.pageFaults),
+                    static_cast<unsigned long long>(counts.contextSwitches));
+        } else {
+            return "";
+        }
+        return numbers;
+    }
+
+    static const char* statusName(TestResult::Status status) {
+        switch (status) {
+            case TestResult::s_passed: return "passed";
+            case TestResult::s_failed: return "failed";
+            case TestResult::s_crashed: return "crashed";
+            case TestResult::s_timedOut: return "timed out";
+        }
+        return "unknown";
+    }
+
+  private:
+    std::ofstream out_;
+    std::string buffer_;
+};
+
+/* JUnit XML, as read by most CI dashboards. The totals go in attributes on
+ * the opening tags, so the test cases are buffered and the whole file is
+ * written once the run finishes.
+ */
+class JUnitSink : public ReportSink {
+  public:
+    explicit JUnitSink(const std::string& path) : path_(path) {
+        std::ofstream probe(path_, std::ios::trunc);
+        if (!probe) {
+            throw std::runtime_error("Couldn't open " + path + " for writing");
+        }
+    }
+
+    void runStarted(size_t) override {
+    }
+
+    void testFinished(const TestReport& report) override {
+        const TestResult& result = report.result;
+        char time[32];
+        std::snprintf(time, sizeof(time), "%.6f", result.wallMs / 1000);
+        cases_ += "    <testcase name=\"" + print::escapeXml(report.name)
+            + "\" classname=\"" + print::escapeXml(className(report.file))
+            + "\" file=\"" + print::escapeXml(report.file)
+            + "\" line=\"" + std::to_string(report.line)
+            + "\" time=\"" + time + "\">\n";
+        if (result.status != TestResult::s_passed) {
+            const char* tag = result.status == TestResult::s_crashed
+                    || result.status == TestResult::s_timedOut
+                ? "error" : "failure";
+            cases_ += std::string("      <") + tag + " message=\""
+                + print::escapeXml(result.failure) + "\">";
+            for (const auto& entry : result.failureCounts) {
+                cases_ += print::escapeXml(std::to_string(entry.second)
+                    + "x " + entry.first + "\n");
+            }
+            cases_ += std::string("</") + tag + ">\n";
+        }
+        if (!result.out.empty()) {
+            cases_ += "      <system-out>" + print::escapeXml(result.out)
+                + "</system-out>\n";
+        }
+        if (!result.err.empty()) {
+            cases_ += "      <system-err>" + print::escapeXml(result.err)
+                + "</system-err>\n";
+        }
+        cases_ += "    </testcase>\n";
+    }
+
+    void runFinished(const RunSummary& summary) override {
+        char attributes[160];
+        std::snprintf(attributes, sizeof(attributes),
+                "tests=\"%zu\" failures=\"%zu\" errors=\"%zu\" skipped=\"%zu\" "
+                "time=\"%.6f\"",
+                summary.numTests, summary.failed.size(), summary.timedOut.size(),
+                summary.numSkipped,
+                summary.wallMs / 1000);
+        std::ofstream out(path_, std::ios::trunc);
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<testsuites " << attributes << ">\n"
+            << "  <testsuite name=\"TestFramework\" " << attributes << ">\n"
+            << cases_
+            << "  </testsuite>\n"
+            << "</testsuites>\n";
+    }
+
+    void flush() override {
+    }
+
+  private:
+    // "tests/QueueTest.cpp" -> "QueueTest"
+    static std::string className(const std::string& file) {
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        return name.substr(0, name.find('.'));
+    }
+
+    std::string path_;
+    std::string cases_;
+};
+
+/* Multi-producer single-consumer queue (Dmitry Vyukov's intrusive design).
+ * push() is a single atomic exchange, so producers never block each other
+ * or the consumer. Only one thread may pop().
+ */
+template <typename T>
+class MpscQueue {
+  public:
+    MpscQueue() : head_(new Node()), tail_(head_.load()) {
+    }
+
+    ~MpscQueue() {
+        T discard;
+        while (pop(discard)) {
+        }
+        delete tail_;
+    }
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& out) {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        out = std::move(next->value);
+        delete tail_;
+        tail_ = next;
+        return true;
+    }
+
+  private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    std::atomic<Node*> head_;
+    Node* tail_;
+};
+
+/* Takes test results from the workers and writes them out on a thread of its
+ * own, so a slow terminal or file never holds up a test.
+ *
+ * Workers push events onto a lock-free queue. The writer thread drains
+ * whatever has piled up, passes each event to every sink, and then flushes
+ * each sink once for the whole batch. When the queue is empty it spins
+ * briefly and then sleeps a millisecond at a time, which also gives the next
+ * batch time to build up.
+ */
+class Reporter {
+  public:
+    Reporter() = default;
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+    ~Reporter() {
+        if (writer_.joinable()) {
+            done_ = true;
+            writer_.join();
+        }
+    }
+
+    void addSink(std::unique_ptr<ReportSink> sink) {
+        sinks_.push_back(std::move(sink));
+    }
+
+    /* Without a writer thread, events are written out by whichever thread
+     * reports them. --isolate uses that, since the parent forks workers as
+     * it goes and a thread in the middle of writing to stdout could leave
+     * locks held in the child.
+     */
+    void start(size_t numTests, bool useWriterThread) {
+        threaded_ = useWriterThread;
+        push(Event{Event::e_started, numTests, nullptr, nullptr});
+        if (threaded_) {
+            writer_ = std::thread([this]() { writeLoop(); });
+        }
+    }
+
+    // Safe to call from any thread
+    void testFinished(TestReport report) {
+        push(Event{Event::e_test, 0,
+                std::make_unique<TestReport>(std::move(report)), nullptr});
+    }
+
+    // Writes out everything still queued and stops the writer thread
+    void finish(RunSummary summary) {
+        push(Event{Event::e_finished, 0, nullptr,
+                std::make_unique<RunSummary>(std::move(summary))});
+        if (threaded_) {
+            done_ = true;
+            writer_.join();
+        }
+    }
+
+  private:
+    struct Event {
+        enum Type {
+            e_started,
+            e_test,
+            e_finished,
+        };
+
+        Type type = e_test;
+        size_t numTests = 0;
+        std::unique_ptr<TestReport> test;
+        std::unique_ptr<RunSummary> summary;
+    };
+
+    void push(Event event) {
+        events_.push(std::move(event));
+        if (!threaded_) {
+            // The queue has one consumer, and without the writer thread that's
+            // whoever holds this. With --isolate the event loops still report
+            // from several threads at once.
+            std::lock_guard lock(inlineMutex_);
+            drain();
+            flush();
+        }
+    }
+
+    void flush() {
+        for (auto& sink : sinks_) {
+            sink->flush();
+        }
+    }
+
+    void writeLoop() {
+        trace::Recorder* recorder = trace::Recorder::active();
+        if (recorder) {
+            recorder->nameThread("reporter");
+        }
+        size_t idleSpins = 0;
+        while (true) {
+            bool finishing = done_.load();
+            const double startMs = recorder ? timing::steadyMs() : 0;
+            size_t handled = drain();
+            if (handled > 0) {
+                idleSpins = 0;
+                flush();
+                // Only batches that had something in them, or the idle
+                // polling would swamp the trace
+                if (recorder) {
+                    recorder->complete("report",
+                            "write " + std::to_string(handled) + " results",
+                            startMs, timing::steadyMs());
+                }
+            } else if (finishing) {
+                // done_ was set before the last push was drained, so the
+                // queue is really empty now
+                return;
+            } else if (++idleSpins < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    size_t drain() {
+        size_t handled = 0;
+        Event event;
+        while (events_.pop(event)) {
+            ++handled;
+            for (auto& sink : sinks_) {
+                switch (event.type) {
+                    case Event::e_started:
+                        sink->runStarted(event.numTests);
+                        break;
+                    case Event::e_test:
+                        sink->testFinished(*event.test);
+                        break;
+                    case Event::e_finished:
+                        sink->runFinished(*event.summary);
+                        break;
+                }
+            }
+        }
+        return handled;
+    }
+
+    std::vector<std::unique_ptr<ReportSink>> sinks_;
+    MpscQueue<Event> events_;
+    std::atomic<bool> done_{false};
+    bool threaded_ = false;
+    std::mutex inlineMutex_;
+    std::thread writer_;
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Hash.h"
+#include "TestRegistry.h"
+#include "TestResult.h"
+
+/* How every test did the last time it ran, kept between runs in a binary
+ * file in the directory the tests are run from (or wherever --results says).
+ * It backs --only-failed, --failed-first and --skip-unchanged.
+ *
+ * The file is a header and then one fixed size record per test, sorted by
+ * the hash of the test's name. It's mapped rather than read, and lookups
+ * binary search the mapping, so startup costs the same however many tests
+ * the suite has. Saving writes a new file and renames it into place, like
+ * TestHistory.
+ *
+ * A test counts as unchanged when its source file hashes the same as when
+ * it last passed. That catches edits to the test itself but not to headers
+ * or libraries it uses, so --skip-unchanged is for iterating locally, not
+ * for CI. If the source can't be read (the binary was moved, say), the
+ * binary itself is hashed instead, so every test counts as changed whenever
+ * it's rebuilt.
+ */
+class ResultCache {
+  public:
+    struct Record {
+        uint64_t nameHash;
+        uint64_t fingerprint;
+        // A TestResult::Status
+        uint32_t status;
+        uint32_t reserved;
+    };
+
+    explicit ResultCache(std::string path) : path_(std::move(path)) {
+        if (path_.empty()) {
+            return;
+        }
+        int fd = open(path_.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0
+                && static_cast<size_t>(info.st_size) >= sizeof(Header)) {
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                mapped_ = data;
+                mappedSize_ = info.st_size;
+            }
+        }
+        close(fd);
+
+        // Anything that doesn't look right is treated as no cache at all
+        const Header* header = static_cast<const Header*>(mapped_);
+        if (header
+                && std::memcmp(header->magic, magic, sizeof(header->magic)) == 0
+                && header->version == version
+                && mappedSize_ == sizeof(Header) + header->count * sizeof(Record)) {
+            records_ = reinterpret_cast<const Record*>(header + 1);
+            numRecords_ = header->count;
+        }
+    }
+
+    ResultCache(ResultCache&& other)
+        : path_(std::move(other.path_)),
+          mapped_(other.mapped_),
+          mappedSize_(other.mappedSize_),
+          records_(other.records_),
+          numRecords_(other.numRecords_),
+          fingerprints_(std::move(other.fingerprints_)),
+          updates_(std::move(other.updates_)) {
+        other.mapped_ = nullptr;
+        other.records_ = nullptr;
+        other.numRecords_ = 0;
+    }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    ~ResultCache() {
+        if (mapped_) {
+            munmap(mapped_, mappedSize_);
+        }
+    }
+
+    // Nullptr for a test with no recorded result
+    const Record* find(const std::string& name) const {
+        const uint64_t hash = hashing::stableHash(name);
+        const Record* end = records_ + numRecords_;
+        const Record* found = std::lower_bound(records_, end, hash,
+                [](const Record& record, uint64_t key) {
+            return record.nameHash < key;
+        });
+        return found != end && found->nameHash == hash ? found : nullptr;
+    }
+
+    bool failedLastTime(const std::string& name) const {
+        const Record* record = find(name);
+        return record && record->status != TestResult::s_passed;
+    }
+
+    bool anyFailed() const {
+        return std::any_of(records_, records_ + numRecords_,
+                [](const Record& record) {
+            return record.status != TestResult::s_passed;
+        });
+    }
+
+    // Passed last time, and its source hasn't changed since
+    bool unchangedSincePass(const TestDescriptor& test) {
+        const Record* record = find(test.name);
+        return record && record->status == TestResult::s_passed
+            && record->fingerprint == fingerprint(test);
+    }
+
+    // Not thread safe; the runner records results once the run is over
+    void record(const TestDescriptor& test, TestResult::Status status) {
+        updates_[hashing::stableHash(test.name)] = Record{
+            hashing::stableHash(test.name), fingerprint(test),
+            static_cast<uint32_t>(status), 0};
+    }
+
+    // Merges this run's results into the ones already on disk
+    void save() {
+        if (path_.empty()) {
+            return;
+        }
+
+        std::vector<Record> records;
+        records.reserve(numRecords_ + updates_.size());
+        for (size_t i = 0; i < numRecords_; ++i) {
+            if (updates_.count(records_[i].nameHash) == 0) {
+                records.push_back(records_[i]);
+            }
+        }
+        for (const auto& entry : updates_) {
+            records.push_back(entry.second);
+        }
+        std::sort(records.begin(), records.end(),
+                [](const Record& a, const Record& b) {
+            return a.nameHash < b.nameHash;
+        });
+
+        Header header;
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        header.count = records.size();
+
+        // Named for this process, so two runs finishing at once in the same
+        // directory don't write over each other's temp file
+        const std::string tmpPath = path_ + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                return;
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(records.data()),
+                    records.size() * sizeof(Record));
+        }
+        std::rename(tmpPath.c_str(), path_.c_str());
+    }
+
+  private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+    };
+
+    static constexpr char magic[4] = {'T', 'F', 'R', 'C'};
+    static constexpr uint32_t version = 1;
+
+    // Hash of the test's source file, worked out once per file
+    uint64_t fingerprint(const TestDescriptor& test) {
+        auto it = fingerprints_.find(test.file);
+        if (it != fingerprints_.end()) {
+            return it->second;
+        }
+        uint64_t hash = 0;
+        if (!hashFile(test.file, hash)) {
+            hashFile("/proc/self/exe", hash);
+        }
+        fingerprints_.emplace(test.file, hash);
+        return hash;
+    }
+
+    static bool hashFile(const char* path, uint64_t& hash) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        hash = hashing::fnv1a(nullptr, 0);
+        char buffer[1 << 16];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+            hash = hashing::fnv1a(buffer, in.gcount(), hash);
+        }
+        return true;
+    }
+
+    std::string path_;
+    void* mapped_ = nullptr;
+    size_t mappedSize_ = 0;
+    const Record* records_ = nullptr;
+    size_t numRecords_ = 0;
+    std::unordered_map<std::string, uint64_t> fingerprints_;
+    // This run's results, by name hash
+    std::unordered_map<uint64_t, Record> updates_;
+};
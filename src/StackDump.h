@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Stack traces of stuck tests, taken from outside the stuck thread.
+ *
+ * The watchdog sends the thread SIGUSR2. The handler runs on that thread,
+ * records its return addresses with backtrace() and then, in-process, waits
+ * in the handler until release(): that keeps the thread still while the
+ * watchdog formats the trace and copies its captured output. The watchdog
+ * stops a stuck thread this way even when no one wants its stack, since
+ * it's the only time the thread's output can be read safely. In an isolated
+ * worker the handler writes the trace to stderr itself and exits, since the
+ * worker is about to be killed anyway.
+ *
+ * Symbol names need the binary to be linked with -rdynamic; without it the
+ * trace still has the module and offset of every frame, which addr2line can
+ * resolve.
+ */
+namespace stackdump {
+
+constexpr int dumpSignal = SIGUSR2;
+constexpr int maxFrames = 64;
+
+struct State {
+    void* frames[maxFrames];
+    int numFrames = 0;
+    std::atomic<bool> ready{false};
+    std::atomic<bool> released{true};
+    bool exitAfterDump = false;
+};
+
+inline State& state() {
+    static State instance;
+    return instance;
+}
+
+inline void writeString(const char* text) {
+    ssize_t ignored = write(STDERR_FILENO, text, std::strlen(text));
+    (void)ignored;
+}
+
+inline void handler(int) {
+    State& s = state();
+    s.numFrames = backtrace(s.frames, maxFrames);
+    if (s.exitAfterDump) {
+        writeString("Stack of the stuck test:\n");
+        // Frame 0 is this handler
+        backtrace_symbols_fd(s.frames + 1, s.numFrames - 1, STDERR_FILENO);
+        _exit(1);
+    }
+    s.ready.store(true, std::memory_order_release);
+    while (!s.released.load(std::memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+/* Installs the handler. exitAfterDump is for isolated workers. Also takes
+ * one trace up front, since the first call to backtrace() loads libgcc and
+ * allocates, which mustn't happen inside the handler.
+ */
+inline void install(bool exitAfterDump) {
+    void* warmup[1];
+    backtrace(warmup, 1);
+    state().exitAfterDump = exitAfterDump;
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(dumpSignal, &action, nullptr);
+}
+
+// "./test(_Z4hangv+0x1c) [0x4011d6]" -> "./test(hang()+0x1c) [0x4011d6]"
+inline std::string demangle(const char* symbol) {
+    std::string line = symbol;
+    size_t open = line.find('(');
+    size_t plus = line.find('+', open);
+    if (open == std::string::npos || plus == std::string::npos
+            || plus == open + 1) {
+        return line;
+    }
+
+    std::string mangled = line.substr(open + 1, plus - open - 1);
+    int status = 0;
+    char* name = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    if (status != 0 || !name) {
+        return line;
+    }
+    line.replace(open + 1, mangled.size(), name);
+    std::free(name);
+    return line;
+}
+
+/* Interrupts thread and waits up to waitMs for it to park in the handler.
+ * Returns whether it did; if so, it stays there until release(), and
+ * nothing it was doing can move in the meantime.
+ */
+inline bool stop(pthread_t thread, double waitMs) {
+    State& s = state();
+    s.ready.store(false);
+    s.released.store(false);
+    if (pthread_kill(thread, dumpSignal) != 0) {
+        s.released.store(true);
+        return false;
+    }
+
+    auto giveUp = std::chrono::steady_clock::now()
+        + std::chrono::duration<double, std::milli>(waitMs);
+    while (!s.ready.load(std::memory_order_acquire)) {
+        if (std::chrono::steady_clock::now() > giveUp) {
+            s.released.store(true);
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// The stack of the thread stop() parked, one frame per line
+inline std::string stack() {
+    State& s = state();
+    std::string trace;
+    char** symbols = backtrace_symbols(s.frames, s.numFrames);
+    // Frame 0 is the handler itself
+    for (int i = 1; i < s.numFrames; ++i) {
+        trace += "    #" + std::to_string(i - 1) + " "
+            + (symbols ? demangle(symbols[i]) : std::string("?")) + "\n";
+    }
+    std::free(symbols);
+    return trace;
+}
+
+// Lets the thread parked by stop() carry on
+inline void release() {
+    state().released.store(true, std::memory_order_release);
+}
+
+} // namespace stackdump
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "TestResult.h"
+
+/* Live numbers for long runs, in the Prometheus text format, so a soak run
+ * that takes hours can be watched (and scraped) while it goes instead of
+ * only at the end.
+ *
+ *     ./tests --repeat 100000 --metrics-file /var/lib/node_exporter/tests.prom
+ *     ./tests --repeat 100000 --metrics-port 9464
+ *
+ * The file is rewritten every --metrics-interval seconds (1 by default) and
+ * renamed into place, so whatever reads it never sees half of one. The port
+ * serves the same text to any GET on 127.0.0.1; 0 picks a free port and
+ * prints it.
+ *
+ * Metrics are updated from the worker threads with relaxed atomics, nothing
+ * more, and read by the exporter's own thread whenever it renders them, so
+ * a scrape can land between a run starting and its result being counted.
+ * Each counter is right on its own; they just aren't a snapshot of one
+ * instant.
+ */
+namespace telemetry {
+
+class Metrics {
+  public:
+    // Upper bounds of the run duration histogram, in seconds
+    static constexpr std::array<double, 12> bucketBounds = {
+        0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60, 300,
+    };
+    static_assert(bucketBounds.size() + 1 == TestResult::numDurationBuckets);
+
+    // The bucket a run that took wallMs goes in
+    static size_t bucketOf(double wallMs) {
+        const double seconds = wallMs / 1000;
+        size_t bucket = 0;
+        while (bucket < bucketBounds.size() && seconds > bucketBounds[bucket]) {
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    void setTests(size_t count) {
+        tests_.store(count, std::memory_order_relaxed);
+    }
+
+    void runsStarted(size_t runs = 1) {
+        runsStarted_.fetch_add(runs, std::memory_order_relaxed);
+        inFlight_.fetch_add(runs, std::memory_order_relaxed);
+    }
+
+    /* Counts the runs in result. started is how many runs runsStarted() was
+     * told about for it, which can be more than finished (a slice that
+     * crashed or timed out partway).
+     */
+    void runsFinished(const TestResult& result, size_t started = 1) {
+        inFlight_.fetch_sub(started, std::memory_order_relaxed);
+        const size_t failed = std::min(result.failedRuns, result.runs);
+        runs_[TestResult::s_passed].fetch_add(
+                result.runs - failed, std::memory_order_relaxed);
+        if (failed > 0) {
+            runs_[result.status].fetch_add(failed, std::memory_order_relaxed);
+        }
+
+        if (result.runs > 0) {
+            // Each run's own duration, where the runner kept them. A result
+            // it didn't is one run, a timeout or a TEST_ASYNC, which wallMs
+            // is the duration of.
+            size_t bucketed = 0;
+            for (size_t i = 0; i < buckets_.size(); ++i) {
+                if (result.durationBuckets[i] > 0) {
+                    buckets_[i].fetch_add(result.durationBuckets[i],
+                            std::memory_order_relaxed);
+                    bucketed += result.durationBuckets[i];
+                }
+            }
+            if (bucketed == 0) {
+                buckets_[bucketOf(result.wallMs / result.runs)].fetch_add(
+                        result.runs, std::memory_order_relaxed);
+            }
+            durationMicros_.fetch_add(static_cast<uint64_t>(result.wallMs * 1000),
+                    std::memory_order_relaxed);
+        }
+        outputBytes_.fetch_add(result.out.size() + result.err.size(),
+                std::memory_order_relaxed);
+    }
+
+    // A test whose runs have all finished and been reported
+    void testReported(TestResult::Status status) {
+        reported_[status].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::string render() const {
+        std::string text;
+        auto metric = [&text](const char* name, const char* type,
+                const char* help) {
+            text += std::string("# HELP ") + name + " " + help + "\n"
+                + "# TYPE " + name + " " + type + "\n";
+        };
+        auto sample = [&text](const std::string& name, double value) {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%.17g", value);
+            text += name + " " + number + "\n";
+        };
+
+        metric("testframework_tests", "gauge", "Tests selected for this run.");
+        sample("testframework_tests", load(tests_));
+
+        metric("testframework_tests_reported_total", "counter",
+                "Tests whose runs have all finished, by outcome.");
+        for (size_t i = 0; i < numStatuses; ++i) {
+            sample(std::string("testframework_tests_reported_total{status=\"")
+                    + statusName(i) + "\"}", load(reported_[i]));
+        }
+
+        metric("testframework_runs_started_total", "counter",
+                "Test runs started.");
+        sample("testframework_runs_started_total", load(runsStarted_));
+
+        metric("testframework_runs_total", "counter",
+                "Test runs finished, by outcome.");
+        for (size_t i = 0; i < numStatuses; ++i) {
+            sample(std::string("testframework_runs_total{status=\"")
+                    + statusName(i) + "\"}", load(runs_[i]));
+        }
+
+        metric("testframework_runs_in_flight", "gauge",
+                "Test runs started and not yet finished.");
+        sample("testframework_runs_in_flight",
+                static_cast<double>(inFlight_.load(std::memory_order_relaxed)));
+
+        metric("testframework_run_duration_seconds", "histogram",
+                "Wall time of each test run.");
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < bucketBounds.size(); ++i) {
+            cumulative += load(buckets_[i]);
+            char bound[32];
+            std::snprintf(bound, sizeof(bound), "%g", bucketBounds[i]);
+            sample(std::string("testframework_run_duration_seconds_bucket{le=\"")
+                    + bound + "\"}", cumulative);
+        }
+        cumulative += load(buckets_[bucketBounds.size()]);
+        sample("testframework_run_duration_seconds_bucket{le=\"+Inf\"}",
+                cumulative);
+        sample("testframework_run_duration_seconds_sum",
+                load(durationMicros_) / 1e6);
+        sample("testframework_run_duration_seconds_count", cumulative);
+
+        metric("testframework_output_bytes_total", "counter",
+                "Bytes of stdout and stderr captured from tests.");
+        sample("testframework_output_bytes_total", load(outputBytes_));
+        return text;
+    }
+
+  private:
+    static constexpr size_t numStatuses = TestResult::s_timedOut + 1;
+
+    static const char* statusName(size_t status) {
+        switch (status) {
+            case TestResult::s_passed: return "passed";
+            case TestResult::s_failed: return "failed";
+            case TestResult::s_crashed: return "crashed";
+            case TestResult::s_timedOut: return "timed_out";
+        }
+        return "unknown";
+    }
+
+    static uint64_t load(const std::atomic<uint64_t>& value) {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> tests_{0};
+    std::atomic<uint64_t> runsStarted_{0};
+    // Signed, since a scrape can see a finish before its start on another
+    // thread
+    std::atomic<int64_t> inFlight_{0};
+    std::array<std::atomic<uint64_t>, numStatuses> runs_{};
+    std::array<std::atomic<uint64_t>, numStatuses> reported_{};
+    // Not cumulative; the last one is everything past the last bound
+    std::array<std::atomic<uint64_t>, bucketBounds.size() + 1> buckets_{};
+    std::atomic<uint64_t> durationMicros_{0};
+    std::atomic<uint64_t> outputBytes_{0};
+};
+
+/* The thread that writes the metrics out, to a file, a port or both. It
+ * sleeps in poll() on the listening socket (if any) and a pipe that wakes it
+ * up to stop. The file gets one last write on the way out, so it ends with
+ * the final numbers.
+ *
+ * With --isolate the process pool forks as it goes, and a fork while this
+ * thread is halfway through writing could leave the child with a lock no one
+ * will ever release. So it renders and writes under a mutex that fork()
+ * takes first (through pthread_atfork), which means forks never land in the
+ * middle of that. Talking to a scraper is only system calls, and a slow one
+ * would hold up every fork, so that part happens outside the mutex.
+ */
+class Exporter {
+  public:
+    Exporter(const Metrics& metrics, std::string path, int port,
+            double intervalSec)
+        : metrics_(metrics),
+          path_(std::move(path)),
+          intervalMs_(static_cast<int>(std::max(0.01, intervalSec) * 1000)) {
+        if (pipe(wakeFds_) != 0) {
+            throw std::runtime_error("Couldn't create a pipe for the metrics thread");
+        }
+        if (port >= 0) {
+            try {
+                listen(port);
+            } catch (...) {
+                close(wakeFds_[0]);
+                close(wakeFds_[1]);
+                throw;
+            }
+        }
+        static std::once_flag registered;
+        std::call_once(registered, []() {
+            pthread_atfork([]() { forkMutex_.lock(); },
+                    []() { forkMutex_.unlock(); },
+                    []() { forkMutex_.unlock(); });
+        });
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    Exporter(const Exporter&) = delete;
+    Exporter& operator=(const Exporter&) = delete;
+
+    ~Exporter() {
+        char stop = 0;
+        (void)!write(wakeFds_[1], &stop, 1);
+        thread_.join();
+        close(wakeFds_[0]);
+        close(wakeFds_[1]);
+        if (listenFd_ >= 0) {
+            close(listenFd_);
+        }
+    }
+
+  private:
+    void listen(int port) {
+        listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        socklen_t length = sizeof(address);
+        if (listenFd_ < 0
+                || bind(listenFd_, reinterpret_cast<sockaddr*>(&address),
+                    sizeof(address)) != 0
+                || ::listen(listenFd_, 16) != 0
+                || getsockname(listenFd_, reinterpret_cast<sockaddr*>(&address),
+                    &length) != 0) {
+            const int error = errno;
+            if (listenFd_ >= 0) {
+                close(listenFd_);
+            }
+            throw std::runtime_error("Couldn't serve metrics on port "
+                    + std::to_string(port) + ": " + std::strerror(error));
+        }
+        if (port == 0) {
+            std::printf("Serving metrics on http://127.0.0.1:%d/metrics\n",
+                    ntohs(address.sin_port));
+            std::fflush(stdout);
+        }
+    }
+
+    void run() {
+        bool stopping = false;
+        while (!stopping) {
+            {
+                std::lock_guard lock(forkMutex_);
+                writeFile();
+            }
+            pollfd fds[2] = {{wakeFds_[0], POLLIN, 0}, {listenFd_, POLLIN, 0}};
+            const int count = poll(fds, listenFd_ >= 0 ? 2 : 1, intervalMs_);
+            if (count > 0 && fds[0].revents) {
+                stopping = true;
+            }
+            if (count > 0 && listenFd_ >= 0 && fds[1].revents) {
+                serve();
+            }
+        }
+        std::lock_guard lock(forkMutex_);
+        writeFile();
+    }
+
+    /* Answers one request, whatever it asked for, with the metrics. Only the
+     * rendering is done under forkMutex_; a scraper that takes its time
+     * sending the request or reading the answer holds up this thread, and
+     * never more than about a second each way, but not the forks.
+     */
+    void serve() {
+        int client = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            return;
+        }
+        timeval sendTimeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout,
+                sizeof(sendTimeout));
+        // The request itself doesn't matter, but reading it first keeps the
+        // client from seeing a reset
+        pollfd request = {client, POLLIN, 0};
+        if (poll(&request, 1, 1000) > 0) {
+            char buffer[4096];
+            (void)!read(client, buffer, sizeof(buffer));
+        }
+        std::string response;
+        {
+            std::lock_guard lock(forkMutex_);
+            const std::string body = metrics_.render();
+            response = "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+        }
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = send(client, response.data() + sent,
+                    response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        close(client);
+    }
+
+    void writeFile() {
+        if (path_.empty()) {
+            return;
+        }
+        const std::string tmpPath = path_ + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            if (!out) {
+                return;
+            }
+            out << metrics_.render();
+        }
+        std::rename(tmpPath.c_str(), path_.c_str());
+    }
+
+    const Metrics& metrics_;
+    std::string path_;
+    int intervalMs_;
+    int listenFd_ = -1;
+    int wakeFds_[2] = {-1, -1};
+    std::thread thread_;
+
+    inline static std::mutex forkMutex_;
+};
+
+} // namespace telemetry
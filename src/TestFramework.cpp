@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "ConcurrentRun.h"
+#include "EventLoop.h"
+#include "TestPrinter.h"
+#include "TestFramework.h"
+
+// This file defines what std::cout is redirected to, so it needs the real one
+#undef cout
+#undef cerr
+
+/* The parts of the public headers that don't need to be templates or
+ * inline. They're compiled once into libtestframework instead of into every
+ * test file.
+ */
+
+namespace assert {
+
+std::string withDetail_(
+        const std::string& message, const std::string& customMessage) {
+    if (customMessage.empty()) {
+        return message;
+    }
+    return message + std::string("\n    Test detail: ") + customMessage;
+}
+
+std::string location_(const char* file, int line) {
+    const char* slash = std::strrchr(file, '/');
+    return std::string(slash ? slash + 1 : file)
+        + ":" + std::to_string(line) + ": ";
+}
+
+static std::string trueMessage(
+        const char* file, int line, const char* expression, bool expected,
+        const std::string& customMessage) {
+    return withDetail_(
+            location_(file, line) + "Failed asserting that " + expression
+                + (expected ? " is True." : " is False."),
+            customMessage);
+}
+
+void failTrue_(
+        const char* file, int line, const char* expression, bool expected,
+        const std::string& customMessage) {
+    throw assertion_error(
+            trueMessage(file, line, expression, expected, customMessage));
+}
+
+namespace {
+
+// Messages past this many are only counted
+const size_t maxExpectMessages = 10;
+
+struct ExpectFailures {
+    size_t count = 0;
+    std::vector<std::string> messages;
+};
+
+thread_local ExpectFailures expectFailures;
+
+} // namespace
+
+bool countExpectFailure_() {
+    return ++expectFailures.count <= maxExpectMessages;
+}
+
+void expectFailed_(std::string message) {
+    alloc::Pause pause;
+    expectFailures.messages.push_back(std::move(message));
+}
+
+void expectTrueFailed_(
+        const char* file, int line, const char* expression, bool expected,
+        const std::string& customMessage) {
+    if (countExpectFailure_()) {
+        expectFailed_(
+                trueMessage(file, line, expression, expected, customMessage));
+    }
+}
+
+std::string takeExpectFailures_() {
+    std::string failures;
+    for (const auto& message : expectFailures.messages) {
+        failures += (failures.empty() ? "" : "\n    ") + message;
+    }
+    if (expectFailures.count > expectFailures.messages.size()) {
+        failures += "\n    ... and "
+            + std::to_string(expectFailures.count - expectFailures.messages.size())
+            + " more failed expectations";
+    }
+    expectFailures = ExpectFailures();
+    return failures;
+}
+
+} // namespace assert
+
+namespace eventloop {
+
+static EventLoop& currentLoop() {
+    EventLoop* loop = EventLoop::current();
+    if (!loop) {
+        throw std::runtime_error(
+                "test::sleep, test::readable and test::writable only work "
+                "inside a TEST_ASYNC");
+    }
+    return *loop;
+}
+
+void sleep_(double ms, Coroutine coroutine) {
+    currentLoop().sleep(ms, coroutine);
+}
+
+void waitFd_(int fd, bool forWriting, Coroutine coroutine) {
+    currentLoop().waitFd(fd, forWriting, coroutine);
+}
+
+void finish_(const std::string& failure) {
+    currentLoop().finish(failure);
+}
+
+} // namespace eventloop
+
+size_t test::threadIndex() {
+    return concurrent::current ? concurrent::current->index : 0;
+}
+
+size_t test::numThreads() {
+    return concurrent::current ? concurrent::current->count : 1;
+}
+
+void test::interleave() {
+    if (concurrent::current && concurrent::current->jitter) {
+        concurrent::interleave(*concurrent::current);
+    }
+}
+
+void test::countOps(uint64_t ops) {
+    if (concurrent::current) {
+        concurrent::current->ops += ops;
+    }
+}
+
+test::Arena& test::arena() {
+    static thread_local Arena threadArena;
+    return threadArena;
+}
+
+void TestRegistry::add(TestDescriptor test) {
+    registered().push_back(std::move(test));
+}
+
+Tests TestRegistry::collect(TestDescriptor::Kind kind) {
+    Tests tests;
+    std::copy_if(registered().begin(), registered().end(),
+            std::back_inserter(tests),
+            [kind](const TestDescriptor& test) {
+        return test.kind == kind;
+    });
+    std::sort(tests.begin(), tests.end(),
+            [](const TestDescriptor& a, const TestDescriptor& b) {
+        return a.name < b.name;
+    });
+
+    auto duplicate = std::adjacent_find(tests.begin(), tests.end(),
+            [](const TestDescriptor& a, const TestDescriptor& b) {
+        return a.name == b.name;
+    });
+    if (duplicate != tests.end()) {
+        throw std::runtime_error(
+                (kind == TestDescriptor::k_test
+                    ? "Duplicate test name: "
+                    : "Duplicate benchmark name: ") + duplicate->name);
+    }
+
+    return tests;
+}
+
+// A function local static so it exists before the first TEST registers,
+// whichever translation unit that happens to be in
+Tests& TestRegistry::registered() {
+    static Tests tests;
+    return tests;
+}
+
+namespace std {
+
+ostream& TestFrameworkGlobalHelper_::getOutStream_() {
+    static TestPrinter printer(&std::cout, TestCapture::c_out);
+    return printer.getStream();
+}
+
+ostream& TestFrameworkGlobalHelper_::getErrStream_() {
+    static TestPrinter printer(&std::cerr, TestCapture::c_err);
+    return printer.getStream();
+}
+
+} // namespace std
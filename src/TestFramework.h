@@ -1,227 +1,159 @@
-#include <iostream>
-#include <vector>
-#include <map>
-#include <string>
-#include <algorithm>
-#include <thread>
-#include <sstream>
-#include <shared_mutex>
-#include <unordered_map>
-
-#include "TestPrinter.h"
-#include "PrintHelpers.h"
-#include "Assert.h"
-
-typedef void(*voidFunc)();
-typedef std::map<std::string, void(*)()> Tests;
+// An include guard rather than #pragma once, which g++ warns about when
+// precompiling the header
+#ifndef TEST_FRAMEWORK_H_
+#define TEST_FRAMEWORK_H_
 
-class TestFramework {
-  public:
-    explicit TestFramework(Tests&& tests): tests_(tests) {
-    }
-
-    void executeTests() {
-        std::vector<std::thread> testThreads;
-        printLine(
-                std::string("Executing ") +
-                std::to_string(tests_.size()) +
-                std::string(" tests:"));
-        startTests();
-        std::for_each(tests_.begin(), tests_.end(),
-                [this, &testThreads]
-                (std::pair<std::string, void(*)()> test) mutable {
-            // TODO: look into batching or a max thread count w/ semaphore
-            testThreads.emplace_back([this, test = std::move(test)]() mutable {
-                std::vector<std::string> testOutput;
-                try {
-                    test.second();
-                    testOutput.push_back(
-                            print::green(test.first + std::string("...OK")));
-                } catch (assert::assertion_error &e) {
-                    testOutput.push_back(
-                            print::red(test.first + std::string("...")));
-                    testOutput.push_back(
-                            print::red(std::string("    ") + e.what()));
-                    std::lock_guard lg(dataMutex_);
-                    failed_.push_back(test.first);
-                } catch (std::exception &e) {
-                    testOutput.push_back(
-                            print::red(test.first + std::string("...")));
-                    testOutput.push_back(print::red(
-                            std::string("    failed with exception: ")
-                            + e.what()));
-                    std::lock_guard lg(dataMutex_);
-                    failed_.push_back(test.first);
-                }
-                auto* outStream =
-                    getOutPrinter().getStreamForThread(std::this_thread::get_id());
-                if (outStream) {
-                    testOutput.emplace_back(
-                            print::yellow("------Test Stdout-------"));
-                    testOutput.push_back(outStream->str());
-                    testOutput.emplace_back(
-                            print::yellow("------------------------"));
-                }
-
-                auto* errStream =
-                    getErrPrinter().getStreamForThread(std::this_thread::get_id());
-                if (errStream) {
-                    testOutput.emplace_back(
-                            print::yellow("------Test Stderr-------"));
-                    testOutput.push_back(errStream->str());
-                    testOutput.emplace_back(
-                            print::yellow("------------------------"));
-                }
-
-                printLines(testOutput);
-            });
-        });
-
-        for (auto& thread : testThreads) {
-            thread.join();
-        }
-
-        // Print final results
-        std::cout << std::endl;
-        size_t numTests = tests_.size();
-        size_t numFailed = failed_.size();
-        if (numFailed == 0) {
-            std::cout << print::boldGreen(std::string("All ")
-                + std::to_string(numTests)
-                + std::string(" tests passed!")) << std::endl;
-        } else {
-            std::string result = std::to_string(numTests - numFailed)
-                + std::string(" of ")
-                + std::to_string(numTests)
-                + std::string(" tests passed.");
-            std::cout << (numFailed < numTests
-                ? print::boldYellow(result)
-                : print::boldRed(result)) << std::endl;
-            std::cout << "The following tests failed:\n";
-
-            // Print faild in consistent order
-            std::sort(failed_.begin(), failed_.end());
-            for (const auto& name : failed_) {
-                std::cout << print::red(std::string("    ") + name)
-                    << std::endl;
-            }
-        }
-    }
-
-    static TestPrinter& getOutPrinter() {
-        static TestPrinter printer(&std::cout);
-        return printer;
-    }
-
-    static TestPrinter& getErrPrinter() {
-        static TestPrinter printer(&std::cerr);
-        return printer;
-    }
-
-    static void doNothing() {}
-
-  private:
-    void printLines(std::vector<std::string> lines) {
-        std::lock_guard g(printMutex_);
-        std::for_each(lines.begin(), lines.end(), [](std::string line) {
-            std::cout << line << std::endl;
-        });
-    }
-
-    void printLine(std::string line) {
-        printLines({std::move(line)});
-    }
-
-    static void startTests() {
-        getOutPrinter().startTests(std::this_thread::get_id());
-        getErrPrinter().startTests(std::this_thread::get_id());
-    }
-
-    Tests tests_;
-    std::mutex printMutex_;
-    std::mutex dataMutex_;
-    std::vector<std::string> failed_;
-};
+#include <ostream>
+#include <string>
 
-class TestMap {
-  public:
-    Tests&& getTests() {
-        return std::move(data_);
-    }
-
-    TestMap(): data_() {
-    }
-
-    TestMap(TestMap&& otherMap) {
-        data_ = std::move(otherMap.data_);
-    }
-
-    void emplace(std::string name, voidFunc&& func) {
-        if (data_.count(name)) {
-            throw std::runtime_error("Duplicate test name: " + name);
-        }
-
-        data_.emplace(name, func);
-    }
-  private:
-    Tests data_;
-};
+#include "Allocations.h"
+#include "Arena.h"
+#include "Assert.h"
+#include "Async.h"
+#include "Benchmark.h"
+#include "Budget.h"
+#include "Concurrent.h"
+#include "Fixture.h"
+#include "Property.h"
+#include "TestRegistry.h"
+
+/* The header test files include. It only has what a test body needs: the
+ * macros, the assertions and the annotations. The runner, the printing and
+ * the capture machinery live in libtestframework, built by the Makefile in
+ * this directory, which also supplies main(). A test binary is built as
+ *
+ *     make -C path/to/src
+ *     g++ -std=c++17 FooTest.cpp BarTest.cpp \
+ *         path/to/src/libtestframework.a -pthread
+ *
+ * with path/to/src/libtestframework_allocs.a after it for allocation
+ * counting (--allocs and ASSERT_MAX_ALLOCS, see Allocations.h).
+ *
+ * The Makefile also precompiles this header (TestFramework.h.gch). g++ picks
+ * it up automatically for any file whose first include is this header, as
+ * long as it's compiled with the same flags (CXXFLAGS in the Makefile).
+ */
 
 // Putting this in namespace std so we can overwrite what std::out does
 namespace std {
 struct TestFrameworkGlobalHelper_ {
   public:
-    static ostream& getOutStream_() {
-        return TestFramework::getOutPrinter().getStream();
-    }
-
-    static ostream& getErrStream_() {
-        return TestFramework::getErrPrinter().getStream();
-    }
+    static ostream& getOutStream_();
+    static ostream& getErrStream_();
 };
 } // namespace std
 
 /*
  * Here's the macro magic that makes the test framework work.
- * Test files should start with TEST_FILE, followed by each test having
- * TEST(name) as a signature and END_TEST_FILE at the end.
- * Under the hood, we make a getTests_ function which writes each user-defined
- * TEST into a map of functions. Then we construct a main method that fetches
- * those tests and passes them to the TestFramework::executeTests processor.
+ * Each test has TEST(name) as a signature followed by its body. Under the
+ * hood, TEST declares a function for the body and a static TestRegistrar_
+ * that adds it to the TestRegistry before main runs. Tests can be spread
+ * across any number of files linked into one binary together with
+ * libtestframework, whose main() collects them all and runs them.
+ *
+ * TEST_F(fixture, name) is TEST with a fixture: the body becomes a member
+ * function of a struct derived from the fixture (see Fixture.h).
+ *
+ * TEST_ASYNC(name) is TEST with a coroutine for a body (see Async.h). It
+ * needs C++20.
+ *
+ * TEST_CONCURRENT(name, threads) runs the body on that many threads at once
+ * (see Concurrent.h).
+ *
+ * BENCHMARK(name) works the same way, except the body is called in a loop and
+ * timed. Benchmarks only run when the binary is passed --bench, and then the
+ * tests don't run, so nothing else competes with them for the CPU.
+ *
+ * TEST_FILE and END_TEST_FILE used to open and close the list of tests in
+ * each file. They're no longer needed but still accepted.
  */
 
-// Create test class and start writing executeTests_ function
-#define TEST_FILE TestMap TestClass_::getTestMap() { \
-        TestMap tests_; \
-        TestFramework::doNothing(
-
-// Close previous test, open new one
-#define TEST(name) ); tests_.emplace(name, []()
-
-// Close previous test, return, add main method for execution
-#define END_TEST_FILE ); \
-    return std::move(tests_); \
-} 
+#define TEST_CONCAT_INNER_(a, b) a##b
+#define TEST_CONCAT_(a, b) TEST_CONCAT_INNER_(a, b)
+
+#define TEST_IMPL_(func, kind, ...) \
+    static void func(); \
+    static TestRegistrar_ TEST_CONCAT_(func, Registrar_)( \
+            __FILE__, __LINE__, &func, kind, __VA_ARGS__); \
+    static void func()
+
+// TEST(name) or TEST(name, annotations...), see test::repeat and test::timeout
+#define TEST(...) TEST_IMPL_( \
+        TEST_CONCAT_(testFunc_, __LINE__), TestDescriptor::k_test, __VA_ARGS__)
+
+#define TEST_F_IMPL_(fixtureType, func, ...) \
+    namespace { \
+    struct TEST_CONCAT_(func, Fixture_) : fixtureType { \
+        void body_(); \
+    }; \
+    } \
+    static void func() { \
+        TEST_CONCAT_(func, Fixture_) instance; \
+        instance.body_(); \
+    } \
+    static TestRegistrar_ TEST_CONCAT_(func, Registrar_)( \
+            __FILE__, __LINE__, &func, TestDescriptor::k_test, __VA_ARGS__, \
+            test::detail::fixture<fixtureType>()); \
+    void TEST_CONCAT_(func, Fixture_)::body_()
+
+// TEST_F(fixture, name) or TEST_F(fixture, name, annotations...)
+#define TEST_F(fixtureType, ...) TEST_F_IMPL_( \
+        fixtureType, TEST_CONCAT_(testFunc_, __LINE__), __VA_ARGS__)
+
+#define TEST_P_IMPL_(func, name, param, ...) \
+    static void func(param); \
+    static void TEST_CONCAT_(func, Case_)(size_t index, uint64_t seed) { \
+        static const auto source = test::detail::firstOf(__VA_ARGS__); \
+        test::detail::runCase(source, &func, index, seed); \
+    } \
+    static TestRegistrar_ TEST_CONCAT_(func, Registrar_)( \
+            __FILE__, __LINE__, nullptr, TestDescriptor::k_test, name, \
+            test::detail::parameterized( \
+                &TEST_CONCAT_(func, Case_), __VA_ARGS__)); \
+    static void func(param)
+
+// TEST_P(name, parameter, source) or TEST_P(name, parameter, source,
+// annotations...), see Property.h. The parameter is declared like a function
+// parameter, e.g. "int n".
+#define TEST_P(name, ...) TEST_P_IMPL_( \
+        TEST_CONCAT_(testFunc_, __LINE__), name, __VA_ARGS__)
+
+// TEST_P with a generator, which reads better as a property
+#define PROPERTY(name, ...) TEST_P(name, __VA_ARGS__)
+
+// TEST_CONCURRENT(name, threads) or TEST_CONCURRENT(name, threads,
+// annotations...), e.g. test::jitter
+#define TEST_CONCURRENT(name, ...) TEST_IMPL_( \
+        TEST_CONCAT_(testFunc_, __LINE__), TestDescriptor::k_test, name, \
+        test::detail::concurrent(__VA_ARGS__))
+
+#ifdef __cpp_impl_coroutine
+
+#define TEST_ASYNC_IMPL_(func, ...) \
+    static test::Async func(); \
+    static eventloop::Coroutine TEST_CONCAT_(func, Start_)() { \
+        return func().release(); \
+    } \
+    static TestRegistrar_ TEST_CONCAT_(func, Registrar_)( \
+            __FILE__, __LINE__, nullptr, TestDescriptor::k_test, __VA_ARGS__, \
+            test::detail::asyncBody(&TEST_CONCAT_(func, Start_))); \
+    static test::Async func()
+
+// TEST_ASYNC(name) or TEST_ASYNC(name, annotations...)
+#define TEST_ASYNC(...) TEST_ASYNC_IMPL_( \
+        TEST_CONCAT_(testFunc_, __LINE__), __VA_ARGS__)
+
+#endif // __cpp_impl_coroutine
+
+#define BENCHMARK(name) TEST_IMPL_( \
+        TEST_CONCAT_(benchmarkFunc_, __LINE__), TestDescriptor::k_benchmark, name)
+
+#define TEST_FILE
+
+#define END_TEST_FILE
 
 #define cout TestFrameworkGlobalHelper_::getOutStream_()
 
 #define cerr TestFrameworkGlobalHelper_::getErrStream_()
 
-// Create stub class for TestClass_ and call it from main
-class TestClass_ {
-  public:
-    static TestMap getTestMap();
-};
-
-int main() {
-    try {
-        TestFramework t(TestClass_::getTestMap().getTests());
-        t.executeTests();
-    } catch (std::exception& e) {
-        std::cout << "Tests did not execute properly, with error:\n    "
-            << e.what() << std::endl;
-        return 1;
-    }
-    return 0;
-}
-
+#endif // TEST_FRAMEWORK_H_
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include <unistd.h>
+
+/* Wall clock time of each test from previous runs, kept in a small text file
+ * in the directory the tests are run from, or wherever --history says (one
+ * "<milliseconds>\t<test name>" line per test).
+ *
+ * The runner uses it to start the historically slowest tests first, so a long
+ * test doesn't end up starting last and dragging out the end of the run.
+ * A missing or unreadable file just means there's no history yet.
+ */
+class TestHistory {
+  public:
+    explicit TestHistory(std::string path) : path_(std::move(path)) {
+        std::ifstream in(path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            auto tab = line.find('\t');
+            if (tab == std::string::npos) {
+                continue;
+            }
+
+            try {
+                durations_[line.substr(tab + 1)] =
+                    std::stod(line.substr(0, tab));
+            } catch (std::exception&) {
+                // Skip lines we can't parse rather than failing the run
+            }
+        }
+    }
+
+    bool empty() const {
+        return durations_.empty();
+    }
+
+    // Returns -1 for tests we haven't seen before
+    double durationMs(const std::string& name) const {
+        auto it = durations_.find(name);
+        return it == durations_.end() ? -1 : it->second;
+    }
+
+    void record(const std::string& name, double wallMs) {
+        durations_[name] = wallMs;
+    }
+
+    // Writes to a temporary file first so an interrupted run can't leave a
+    // half written history behind. The temp file is named for this process
+    // so runs finishing at once don't share one.
+    void save() const {
+        if (path_.empty()) {
+            return;
+        }
+
+        const std::string tmpPath = path_ + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            if (!out) {
+                return;
+            }
+            for (const auto& entry : durations_) {
+                out << entry.second << '\t' << entry.first << '\n';
+            }
+        }
+        std::rename(tmpPath.c_str(), path_.c_str());
+    }
+
+  private:
+    std::string path_;
+    std::unordered_map<std::string, double> durations_;
+};
@@ -0,0 +1,75 @@
+#include <optional>
+
+#include <unistd.h>
+
+#include "BenchmarkRunner.h"
+#include "TestRunner.h"
+#include "Trace.h"
+
+/* The one main() for a test binary. It's part of libtestframework, so linking
+ * any number of test files against the library is all it takes, e.g.
+ *
+ *     g++ -std=c++17 FooTest.cpp BarTest.cpp libtestframework.a -pthread
+ */
+int main(int argc, char** argv) {
+    try {
+        RunOptions opts = parseOptions(argc, argv);
+        std::optional<trace::Recorder> tracer;
+        if (!opts.tracePath.empty() && !opts.runBenchmarks) {
+            tracer.emplace(opts.tracePath);
+            tracer->nameThread("main");
+        }
+
+        std::optional<trace::Span> selecting;
+        selecting.emplace("phase", "select tests");
+        TestHistory history(opts.historyPath);
+        ResultCache results(opts.runBenchmarks ? "" : opts.resultsPath);
+        Tests tests = selection::selectTests(
+                TestRegistry::collect(opts.runBenchmarks
+                    ? TestDescriptor::k_benchmark
+                    : TestDescriptor::k_test),
+                opts,
+                history);
+        size_t numUnchanged = selection::selectByResults(tests, opts, results);
+        selecting.reset();
+
+        if (opts.list) {
+            for (const auto& test : tests) {
+                std::cout << test.name << '\n';
+            }
+            return 0;
+        }
+
+        if (opts.runBenchmarks) {
+            bench::Settings settings;
+            settings.numSamples = opts.benchSamples;
+            settings.sampleMs = static_cast<double>(opts.benchSampleMs);
+            settings.perf = opts.reportPerf;
+            settings.perfHardware = opts.perfHardware;
+            bench::BenchmarkRunner runner(settings);
+            return runner.run(tests, opts.benchOutPath) > 0 ? 1 : 0;
+        }
+
+        if (numUnchanged > 0) {
+            std::cout << "Skipping " << numUnchanged
+                << " unchanged tests that passed last time." << std::endl;
+        }
+        TestRunner t(std::move(tests), opts, std::move(history),
+                std::move(results));
+        const int status = t.executeTests() > 0 ? 1 : 0;
+        if (tracer) {
+            tracer->write();
+        }
+        if (t.hasAbandonedThreads()) {
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(status);
+        }
+        return status;
+    } catch (std::exception& e) {
+        std::cout << "Tests did not execute properly, with error:\n    "
+            << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
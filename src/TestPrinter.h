@@ -1,60 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "Allocations.h"
+#include "OutputSpool.h"
+
 // For capturing the std::out and std::err during test runs
-struct TestPrinter {
+
+/* Stream buffer that appends everything written to it to a capture::Spool,
+ * which keeps memory bounded however much the test writes (see
+ * OutputSpool.h). It's only ever written by the thread running the test that
+ * owns it, so there's no locking.
+ */
+class CaptureBuffer : public std::streambuf {
   public:
-    explicit TestPrinter(std::ostream* defaultStream)
-        : streamMutex_(), defaultStream_(defaultStream) {};
-
-    // If the thread ID is for a known thread, return its
-    // existing stream
-    std::stringstream* getStreamForThread(std::thread::id id) {
-        std::shared_lock r_lock(streamMutex_);
-        if (streams.count(id)) {
-            return &(streams.at(id));
+    bool empty() const {
+        return data_.empty();
+    }
+
+    // Only safe while the writing thread is stopped (see Watchdog), and not
+    // partway through writing
+    std::string copy() const {
+        return data_.read();
+    }
+
+    // Whether the writing thread is in the middle of an append. Exact once
+    // that thread is parked in a signal handler, which is when it's asked.
+    bool writing() const {
+        return writing_.load(std::memory_order_relaxed);
+    }
+
+    // Leaves the buffer empty
+    std::string take() {
+        return data_.take();
+    }
+
+    void clear() {
+        data_.clear();
+    }
+
+  protected:
+    // The buffer's memory belongs to the framework, not the test
+    int_type overflow(int_type ch) override {
+        alloc::Pause pause;
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            const char c = traits_type::to_char_type(ch);
+            writing_.store(true, std::memory_order_relaxed);
+            data_.append(&c, 1);
+            writing_.store(false, std::memory_order_relaxed);
         }
+        return traits_type::not_eof(ch);
+    }
 
-        return nullptr;
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        alloc::Pause pause;
+        writing_.store(true, std::memory_order_relaxed);
+        data_.append(s, static_cast<size_t>(n));
+        writing_.store(false, std::memory_order_relaxed);
+        return n;
     }
 
-    /* In TestFramework, this is what's called instead of cout. If we haven't
-     * started our test runs yet, we can just use cout. If we're running
-     * parallel tests, we need to capture the full output for each test in a
-     * thread safe way.
-     *
-     * Store a mapping of thread ID to ostream. Use a shared lock for threads
-     * just fetching streams. Use a unique_lock for threads that put new streams
-     * in the map values to a stream.
+  private:
+    capture::Spool data_;
+    std::atomic<bool> writing_{false};
+};
+
+/* Output captured while one test runs. The runner creates one per test and
+ * calls start() on the thread that runs it; from then until stop(), cout and
+ * cerr on that thread write into this object instead of the real streams.
+ */
+class TestCapture {
+  public:
+    enum Channel {
+        c_out = 0,
+        c_err = 1,
+    };
+
+    TestCapture() : out_(&outBuf_), err_(&errBuf_) {
+    }
+
+    TestCapture(const TestCapture&) = delete;
+    TestCapture& operator=(const TestCapture&) = delete;
+
+    ~TestCapture() {
+        stop();
+    }
+
+    void start() {
+        active_ = this;
+    }
+
+    void stop() {
+        if (active_ == this) {
+            active_ = nullptr;
+        }
+    }
+
+    // Returns false if the test didn't write anything to this channel
+    bool take(Channel channel, std::string& output) {
+        CaptureBuffer& buf = channel == c_out ? outBuf_ : errBuf_;
+        if (buf.empty()) {
+            return false;
+        }
+
+        output = buf.take();
+        return true;
+    }
+
+    // Throws away everything captured so far, without reading any of it
+    // back
+    void discard() {
+        outBuf_.clear();
+        errBuf_.clear();
+    }
+
+    // Everything captured so far, from another thread. The test's thread has
+    // to be stopped while this runs, and not writing().
+    std::string snapshot(Channel channel) const {
+        return (channel == c_out ? outBuf_ : errBuf_).copy();
+    }
+
+    bool writing() const {
+        return outBuf_.writing() || errBuf_.writing();
+    }
+
+    // The capture running on the calling thread, if any
+    static TestCapture* active() {
+        return active_;
+    }
+
+    std::ostream& stream(Channel channel) {
+        return channel == c_out ? out_ : err_;
+    }
+
+  private:
+    CaptureBuffer outBuf_;
+    CaptureBuffer errBuf_;
+    std::ostream out_;
+    std::ostream err_;
+
+    inline static thread_local TestCapture* active_ = nullptr;
+};
+
+struct TestPrinter {
+  public:
+    TestPrinter(std::ostream* defaultStream, TestCapture::Channel channel)
+        : defaultStream_(defaultStream), channel_(channel) {};
+
+    /* In TestFramework, this is what's called instead of cout. Threads that
+     * are running a test write into that test's capture; everything else
+     * (including the main thread) keeps using cout or cerr (defaultStream_).
      *
-     * The main thread can continue using cout or err (defaultStream_).
+     * The capture is found through a thread_local pointer, so writing takes
+     * no locks and costs one pointer load on top of the stream itself.
      */
     std::ostream& getStream() {
-        const auto this_id = std::this_thread::get_id();
-        if (startedTestRun_ && this_id != mainThread_) {
-            // See if we already have a stream for this thread
-            auto* stream = getStreamForThread(this_id);
-            if (stream) {
-                return *stream;
-            }
-
-            // If we don't we need to lock the writer ability on the lock and
-            // add a new stream
-            std::unique_lock w_lock(streamMutex_);
-            streams.emplace(this_id, std::stringstream());
-            return streams.at(this_id);
+        TestCapture* capture = TestCapture::active();
+        if (capture) {
+            return capture->stream(channel_);
         }
 
         return *defaultStream_;
     }
 
-  void startTests(std::thread::id id) {
-      startedTestRun_ = true;
-      mainThread_ = id;
-  }
-
   private:
-    std::unordered_map<std::thread::id, std::stringstream> streams;
-    std::shared_mutex streamMutex_;
-    std::thread::id mainThread_;
     std::ostream* defaultStream_;
-    bool startedTestRun_ = false;
+    TestCapture::Channel channel_;
 };
-
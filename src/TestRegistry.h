@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef void(*voidFunc)();
+// Runs one case of a TEST_P, see Property.h
+typedef void(*caseFunc)(size_t caseIndex, uint64_t seed);
+
+namespace eventloop {
+struct Coroutine;
+}
+// Creates the outermost coroutine of a TEST_ASYNC, suspended before its
+// first line. See Async.h.
+typedef eventloop::Coroutine (*asyncFunc)();
+
+// Everything the runner needs to know about one TEST or BENCHMARK
+struct TestDescriptor {
+    enum Kind {
+        k_test = 0,
+        k_benchmark = 1,
+    };
+
+    std::string name;
+    // Null for a TEST_P or TEST_ASYNC, which have runCase or startAsync
+    // instead
+    voidFunc func;
+    const char* file;
+    int line;
+    Kind kind = k_test;
+
+    // Set by test::repeat. 0 means use --repeat and --concurrency.
+    size_t repeat = 0;
+    size_t concurrency = 0;
+
+    // A TEST_P runs each of its numCases once instead of repeating
+    caseFunc runCase = nullptr;
+    size_t numCases = 0;
+
+    asyncFunc startAsync = nullptr;
+
+    // A TEST_CONCURRENT runs func on this many threads at once, see
+    // Concurrent.h. 0 for every other test.
+    size_t numThreads = 0;
+    bool jitter = false;
+
+    // Set by test::timeout. 0 means use --timeout.
+    double timeoutMs = 0;
+
+    // Builds the suite fixture of a TEST_F, if it has one. Called once per
+    // distinct function before any test runs.
+    voidFunc prepare = nullptr;
+};
+
+typedef std::vector<TestDescriptor> Tests;
+
+/* Every TEST in every linked translation unit adds itself here during static
+ * initialization, before main runs. The runner then calls collect() once to
+ * get all of them as one table, no matter how many files they came from.
+ */
+class TestRegistry {
+  public:
+    static void add(TestDescriptor test);
+
+    /* Returns every registered test (or benchmark) sorted by name. Static
+     * initialization order across files is unspecified, so sorting is what
+     * keeps the table (and everything scheduled from it) the same from run to
+     * run.
+     */
+    static Tests collect(TestDescriptor::Kind kind = TestDescriptor::k_test);
+
+  private:
+    static Tests& registered();
+};
+
+/* Annotations that can follow the name in TEST(...), e.g.
+ *
+ *     TEST("QueueStress", test::repeat(10000, 8)) { ... }
+ */
+namespace test {
+
+// Run the body this many times, with up to this many runs at once
+struct repeat {
+    explicit repeat(size_t runs, size_t concurrency = 1)
+        : runs_(runs), concurrency_(concurrency) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.repeat = runs_ ? runs_ : 1;
+        test.concurrency = concurrency_ ? concurrency_ : 1;
+    }
+
+  private:
+    size_t runs_;
+    size_t concurrency_;
+};
+
+// Time limit for each run of the test, overriding --timeout
+struct timeout {
+    explicit timeout(double seconds) : seconds_(seconds) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.timeoutMs = seconds_ * 1000;
+    }
+
+  private:
+    double seconds_;
+};
+
+// Number of cases to generate for a PROPERTY
+struct cases {
+    explicit cases(size_t count) : count_(count) {
+    }
+
+    void apply(TestDescriptor& test) const {
+        test.numCases = count_ ? count_ : 1;
+    }
+
+  private:
+    size_t count_;
+};
+
+} // namespace test
+
+struct TestRegistrar_ {
+    template <typename... Annotations>
+    TestRegistrar_(
+            const char* file,
+            int line,
+            voidFunc func,
+            TestDescriptor::Kind kind,
+            const char* name,
+            const Annotations&... annotations) {
+        TestDescriptor test{name, func, file, line, kind};
+        (annotations.apply(test), ...);
+        TestRegistry::add(std::move(test));
+    }
+};
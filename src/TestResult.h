@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.h"
+
+/* What happened when a test ran, independent of how it gets reported. A
+ * result can cover several runs of the same test (--repeat), merged
+ * together with merge().
+ */
+struct TestResult {
+    // In order of severity, so merging keeps the worst
+    enum Status {
+        s_passed = 0,
+        s_failed = 1,
+        // The process running the test died (isolated runs only)
+        s_crashed = 2,
+        // Ran past its timeout and was abandoned (or killed, if isolated)
+        s_timedOut = 3,
+    };
+
+    Status status = s_passed;
+
+    // Printed under the test name when it didn't pass. With several runs,
+    // this is the first failure seen.
+    std::string failure;
+
+    size_t runs = 1;
+    size_t failedRuns = 0;
+    // Each distinct failure message and how many runs hit it
+    std::map<std::string, size_t> failureCounts;
+
+    // Everything the test wrote to stdout and stderr. Empty if nothing. With
+    // several runs, the output of the first failing run is kept, or the
+    // first run if they all passed.
+    std::string out;
+    std::string err;
+
+    double wallMs = 0;
+    double cpuMs = 0;
+
+    // How many runs fell in each bucket of the run duration histogram (see
+    // Telemetry.h), so every run counts on its own even once merged. All
+    // zero for a result that was never bucketed, like a timeout's.
+    static constexpr size_t numDurationBuckets = 13;
+    std::array<uint32_t, numDurationBuckets> durationBuckets{};
+
+    // From alloc::Scope. Summed over runs, except the peak, which is the
+    // highest of any run.
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+    size_t peakBytes = 0;
+    size_t leakedBytes = 0;
+
+    // With --perf, summed over runs
+    perf::Counts counters;
+
+    // One per thread of a TEST_CONCURRENT: operations counted with
+    // test::countOps, and how long the thread took from the barrier on.
+    // Summed over runs.
+    struct ThreadOps {
+        uint64_t ops = 0;
+        double ms = 0;
+    };
+    std::vector<ThreadOps> threadOps;
+
+    // steady_clock milliseconds. CLOCK_MONOTONIC is shared by every process
+    // on the machine, so these are comparable across isolated workers.
+    double startMs = 0;
+    double endMs = 0;
+
+    void fail(Status newStatus, std::string message) {
+        status = newStatus;
+        failure = message;
+        failedRuns = runs;
+        failureCounts[std::move(message)] += runs;
+    }
+
+    // The failure message for a run stopped at its timeout
+    static std::string describeTimeout(double timeoutMs) {
+        char message[64];
+        std::snprintf(message, sizeof(message), "timed out after %gs",
+                timeoutMs / 1000);
+        return message;
+    }
+
+    // Folds other runs of the same test into this result
+    void merge(TestResult&& other) {
+        if (other.runs == 0) {
+            return;
+        }
+        if (runs == 0) {
+            *this = std::move(other);
+            return;
+        }
+
+        if (status == s_passed && other.status != s_passed) {
+            out = std::move(other.out);
+            err = std::move(other.err);
+        }
+        if (failure.empty()) {
+            failure = std::move(other.failure);
+        }
+        status = std::max(status, other.status);
+        runs += other.runs;
+        failedRuns += other.failedRuns;
+        for (auto& entry : other.failureCounts) {
+            failureCounts[entry.first] += entry.second;
+        }
+        cpuMs += other.cpuMs;
+        for (size_t i = 0; i < numDurationBuckets; ++i) {
+            durationBuckets[i] += other.durationBuckets[i];
+        }
+        allocations += other.allocations;
+        allocatedBytes += other.allocatedBytes;
+        peakBytes = std::max(peakBytes, other.peakBytes);
+        leakedBytes += other.leakedBytes;
+        counters.merge(other.counters);
+        threadOps.resize(std::max(threadOps.size(), other.threadOps.size()));
+        for (size_t i = 0; i < other.threadOps.size(); ++i) {
+            threadOps[i].ops += other.threadOps[i].ops;
+            threadOps[i].ms += other.threadOps[i].ms;
+        }
+        startMs = std::min(startMs, other.startMs);
+        endMs = std::max(endMs, other.endMs);
+        wallMs = endMs - startMs;
+    }
+};
@@ -0,0 +1,620 @@
+#pragma once
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <sstream>
+#include <mutex>
+#include <set>
+#include <streambuf>
+
+#include "Allocations.h"
+#include "Arena.h"
+#include "Options.h"
+#include "ProcessPool.h"
+#include "ResultCache.h"
+#include "Reporter.h"
+#include "TestHistory.h"
+#include "TestPrinter.h"
+#include "TestRegistry.h"
+#include "TestResult.h"
+#include "TestSelection.h"
+#include "Telemetry.h"
+#include "Trace.h"
+#include "Timing.h"
+#include "Watchdog.h"
+#include "WorkerPool.h"
+#include "PrintHelpers.h"
+#include "Assert.h"
+#include "BudgetGate.h"
+#include "ConcurrentRun.h"
+#include "EventLoop.h"
+
+/* Runs the selected tests and reports on them. This and everything it
+ * includes is the library side of the framework: it's compiled once into
+ * libtestframework, never into the test files themselves.
+ */
+class TestRunner {
+  public:
+    TestRunner(Tests&& tests, const RunOptions& opts, TestHistory&& history,
+            ResultCache&& results)
+        : tests_(std::move(tests)),
+          pool_(opts.numWorkers),
+          history_(std::move(history)),
+          results_(std::move(results)),
+          failedFirst_(opts.failedFirst),
+          numSlowest_(opts.numSlowest),
+          isolate_(opts.isolate),
+          repeat_(std::max<size_t>(1, opts.repeat)),
+          concurrency_(std::max<size_t>(1, opts.concurrency)),
+          failFast_(opts.failFast),
+          timeoutSec_(opts.timeoutSec),
+          seed_(opts.seed),
+          dumpStacks_(opts.dumpStacks),
+          perf_(opts.reportPerf),
+          perfHardware_(opts.perfHardware) {
+        // Before any worker is started or forked
+        capture::limits.memoryBytes = opts.captureMemoryBytes;
+        capture::limits.shownBytes = opts.outputLimitBytes;
+        capture::limits.discardPassing = opts.discardPassingOutput;
+        reporter_.addSink(std::make_unique<ConsoleSink>(
+                    opts.reportAllocs, opts.reportPerf));
+        if (!opts.jsonPath.empty()) {
+            reporter_.addSink(std::make_unique<JsonLinesSink>(opts.jsonPath));
+        }
+        if (!opts.junitPath.empty()) {
+            reporter_.addSink(std::make_unique<JUnitSink>(opts.junitPath));
+        }
+        if (!opts.metricsPath.empty() || opts.metricsPort >= 0) {
+            exporter_ = std::make_unique<telemetry::Exporter>(metrics_,
+                    opts.metricsPath, opts.metricsPort, opts.metricsIntervalSec);
+        }
+    }
+
+    // Returns how many tests failed, crashed or timed out
+    size_t executeTests() {
+        timing::Stopwatch stopwatch;
+        reporter_.start(tests_.size(), !isolate_);
+        metrics_.setTests(tests_.size());
+
+        std::vector<const TestDescriptor*> tests;
+        for (const auto& test : tests_) {
+            tests.push_back(&test);
+        }
+        scheduleLongestFirst(tests);
+        if (failedFirst_) {
+            std::stable_partition(tests.begin(), tests.end(),
+                    [this](const TestDescriptor* test) {
+                return results_.failedLastTime(test->name);
+            });
+        }
+        {
+            trace::Span span("phase", "prepare fixtures");
+            prepareFixtures(tests);
+        }
+
+        auto async = std::stable_partition(tests.begin(), tests.end(),
+                [](const TestDescriptor* test) {
+            return test->startAsync == nullptr;
+        });
+        std::vector<const TestDescriptor*> asyncTests(async, tests.end());
+        tests.erase(async, tests.end());
+        {
+            trace::Span span("phase", "run tests");
+            runTests(tests);
+        }
+        if (!asyncTests.empty()) {
+            trace::Span span("phase", "run async tests");
+            runAsyncTests(asyncTests);
+        }
+
+        // Until the end: the summary, then saving history and results
+        trace::Span reporting("phase", "report");
+
+        RunSummary summary;
+        summary.numTests = tests_.size();
+        summary.numSkipped = numSkipped_;
+        summary.numPassed = tests_.size() - failed_.size() - timedOut_.size()
+            - numSkipped_;
+        // Print faild in consistent order
+        std::sort(failed_.begin(), failed_.end());
+        std::sort(timedOut_.begin(), timedOut_.end());
+        summary.failed = failed_;
+        summary.timedOut = timedOut_;
+        summary.wallMs = stopwatch.wallMs();
+        reporter_.finish(std::move(summary));
+        // Last write of the metrics file, with everything counted
+        exporter_.reset();
+
+        printSlowest();
+        for (const auto& timing : timings_) {
+            history_.record(timing.name, timing.wallMs);
+        }
+        history_.save();
+        for (const auto& entry : statuses_) {
+            results_.record(*entry.first, entry.second);
+        }
+        results_.save();
+        return failed_.size() + timedOut_.size();
+    }
+
+    /* True if a timed out test's thread is still stuck somewhere. It can't be
+     * joined or cancelled, so the caller should leave with _exit() instead of
+     * running static destructors underneath it.
+     */
+    bool hasAbandonedThreads() const {
+        return abandonedThreads_;
+    }
+
+  private:
+    // A batch of runs of one test, executed back to back by one worker
+    struct Slice {
+        const TestDescriptor* test;
+        size_t testIndex;
+        size_t runs;
+        // Index of the first run, which is the case index for a TEST_P
+        size_t firstRun;
+        // The pool worker running it, for the watchdog
+        size_t worker;
+    };
+
+    // Results of a test's slices, merged as they finish
+    struct PendingTest {
+        std::mutex mutex;
+        size_t slicesLeft = 0;
+        TestResult result;
+    };
+
+    /* Builds every suite fixture the tests use, once, on this thread and
+     * before any worker starts (or is forked, so isolated workers share the
+     * parent's copy). A suite whose constructor throws is left for each of
+     * its tests to fail on.
+     */
+    void prepareFixtures(const std::vector<const TestDescriptor*>& tests) {
+        std::set<voidFunc> prepared;
+        for (const TestDescriptor* test : tests) {
+            if (test->prepare && prepared.insert(test->prepare).second) {
+                try {
+                    test->prepare();
+                } catch (std::exception&) {
+                }
+            }
+        }
+    }
+
+    // In milliseconds, 0 for none
+    double timeoutMs(const TestDescriptor& test) const {
+        return test.timeoutMs > 0 ? test.timeoutMs : timeoutSec_ * 1000;
+    }
+
+    /* Runs one test on the calling thread. In-process that's a pool worker,
+     * which may already have run other tests; with --isolate it's a forked
+     * worker process whose stdout and stderr already go to the parent, so
+     * there's nothing to capture here.
+     *
+     * Returns nothing if the watchdog gave up on the test while it ran. It's
+     * been reported already and this thread replaced, so the caller has to
+     * get out without touching anything shared.
+     */
+    std::optional<TestResult> runTest(const TestDescriptor& test,
+            const Slice& slice, size_t run, bool captureOutput) {
+        TestResult result;
+        TestCapture capture;
+        // Isolated runs are counted and traced by the parent as their slices
+        // go
+        std::optional<trace::Span> span;
+        if (captureOutput) {
+            metrics_.runsStarted();
+            span.emplace("test", test.name);
+            capture.start();
+        }
+        // Held back while another test measures a budget
+        budget::gate().enter();
+        result.startMs = timing::steadyMs();
+        timing::Stopwatch stopwatch;
+        {
+            // Kept open until the exception (and anything it owns) is gone
+            alloc::Scope allocations;
+            std::string failure;
+            if (watchdogSlot_) {
+                Watchdog::begin(watchdogSlot_, slice.worker, &slice,
+                        captureOutput ? &capture : nullptr, timeoutMs(test));
+            }
+            perf::ThreadCounters* counters = perf_
+                ? &perf::ThreadCounters::forThisThread(perfHardware_)
+                : nullptr;
+            if (counters) {
+                counters->start();
+            }
+            try {
+                if (test.numThreads) {
+                    concurrent::run(test, seed_ + run, result.threadOps);
+                } else if (test.runCase) {
+                    test.runCase(run, seed_);
+                } else {
+                    test.func();
+                }
+            } catch (assert::assertion_error &e) {
+                alloc::Pause pause;
+                failure = e.what();
+            } catch (std::exception &e) {
+                alloc::Pause pause;
+                failure = std::string("failed with exception: ") + e.what();
+            } catch (...) {
+                alloc::Pause pause;
+                failure = "failed with an unknown exception";
+            }
+            if (counters) {
+                result.counters = counters->stop();
+            }
+            if (watchdogSlot_ && !Watchdog::end(watchdogSlot_)) {
+                return std::nullopt;
+            }
+            budget::gate().leave();
+            {
+                // Expectations that failed before the test ended (or before
+                // the assertion that ended it) come first
+                alloc::Pause pause;
+                std::string expectFailures = assert::takeExpectFailures_();
+                if (!expectFailures.empty()) {
+                    failure = failure.empty() ? expectFailures
+                        : expectFailures + "\n    " + failure;
+                }
+                if (!failure.empty()) {
+                    result.fail(TestResult::s_failed, std::move(failure));
+                }
+            }
+            alloc::Stats stats = allocations.stats();
+            result.allocations = stats.allocations;
+            result.allocatedBytes = stats.bytes;
+            result.peakBytes = stats.peakBytes;
+            result.leakedBytes = stats.liveBytes;
+        }
+        capture.stop();
+        test::arena().reset();
+
+        result.wallMs = stopwatch.wallMs();
+        result.cpuMs = stopwatch.cpuMs();
+        result.endMs = result.startMs + result.wallMs;
+        ++result.durationBuckets[telemetry::Metrics::bucketOf(result.wallMs)];
+        if (result.status == TestResult::s_passed
+                && capture::limits.discardPassing) {
+            capture.discard();
+        }
+        capture.take(TestCapture::c_out, result.out);
+        capture.take(TestCapture::c_err, result.err);
+        if (captureOutput) {
+            metrics_.runsFinished(result);
+            span->setStatus(trace::statusName(result.status));
+        }
+        return result;
+    }
+
+    // Runs one slice of a repeated test: several runs one after another.
+    // Returns nothing if one of them timed out in-process, as runTest.
+    std::optional<TestResult> runSlice(const Slice& slice, bool captureOutput) {
+        TestResult combined;
+        combined.runs = 0;
+        for (size_t i = 0; i < slice.runs && !stopRequested_; ++i) {
+            std::optional<TestResult> result =
+                runTest(*slice.test, slice, slice.firstRun + i, captureOutput);
+            if (!result) {
+                return std::nullopt;
+            }
+            if (result->status != TestResult::s_passed && failFast_) {
+                stopRequested_ = true;
+            }
+            combined.merge(std::move(*result));
+        }
+        return combined;
+    }
+
+    /* Splits every test into slices and runs them, either on the thread pool
+     * or (with --isolate) in worker processes. A test that runs once is one
+     * slice. A repeated test is split into one slice per concurrent run, and
+     * it's reported once its last slice finishes. A TEST_P is a repeated test
+     * whose runs are its cases, spread over every worker.
+     *
+     * A slice that times out is finished off by whoever noticed: the
+     * watchdog in-process, which also swaps the stuck worker thread for a new
+     * one, or the process pool once it has killed the worker. Runs the slice
+     * had already done are dropped; the timeout is what gets reported.
+     */
+    void runTests(const std::vector<const TestDescriptor*>& tests) {
+        std::vector<Slice> slices;
+        std::vector<PendingTest> pending(tests.size());
+        for (size_t i = 0; i < tests.size(); ++i) {
+            size_t runs = tests[i]->repeat ? tests[i]->repeat : repeat_;
+            size_t concurrency = std::min(runs,
+                    tests[i]->concurrency ? tests[i]->concurrency : concurrency_);
+            if (tests[i]->runCase) {
+                runs = tests[i]->numCases;
+                concurrency = std::min(runs, pool_.size());
+            }
+            size_t firstRun = 0;
+            for (size_t s = 0; s < concurrency; ++s) {
+                size_t share = runs / concurrency + (s < runs % concurrency);
+                slices.push_back(Slice{tests[i], i, share, firstRun, 0});
+                firstRun += share;
+            }
+            pending[i].slicesLeft = concurrency;
+            pending[i].result.runs = 0;
+        }
+
+        auto finishSlice = [this, &slices, &pending](
+                size_t task, TestResult&& result) {
+            const Slice& slice = slices[task];
+            PendingTest& test = pending[slice.testIndex];
+            {
+                std::lock_guard lg(test.mutex);
+                test.result.merge(std::move(result));
+                if (--test.slicesLeft > 0) {
+                    return;
+                }
+            }
+            finish(*slice.test, std::move(test.result));
+        };
+
+        if (isolate_) {
+            // The whole slice runs in one go in the worker, so its time limit
+            // covers all of its runs
+            ProcessPool processes(pool_.size(),
+                    [this, &slices](size_t task) {
+                return *runSlice(slices[task], false);
+            },
+                    [this, &slices](size_t task) {
+                return timeoutMs(*slices[task].test) * slices[task].runs;
+            },
+                    dumpStacks_);
+
+            std::vector<size_t> order;
+            for (size_t i = 0; i < slices.size(); ++i) {
+                order.push_back(i);
+            }
+            processes.run(order,
+                    [this, &processes, &slices, &finishSlice](
+                            size_t task, TestResult&& result) {
+                metrics_.runsFinished(result, slices[task].runs);
+                if (trace::Recorder* recorder = trace::Recorder::active()) {
+                    recorder->completeOnLane("test", slices[task].test->name,
+                            slices[task].worker, result.startMs, result.endMs,
+                            trace::statusName(result.status));
+                }
+                if (result.status != TestResult::s_passed && failFast_) {
+                    processes.stop();
+                }
+                finishSlice(task, std::move(result));
+            },
+                    [this, &slices](size_t task, size_t worker) {
+                slices[task].worker = worker;
+                metrics_.runsStarted(slices[task].runs);
+            });
+
+            // Slices that were never started after a stop
+            for (size_t i = 0; i < tests.size(); ++i) {
+                if (pending[i].slicesLeft > 0) {
+                    finish(*tests[i], std::move(pending[i].result));
+                }
+            }
+        } else {
+            const bool anyTimeout = std::any_of(tests.begin(), tests.end(),
+                    [this](const TestDescriptor* test) {
+                return timeoutMs(*test) > 0;
+            });
+            if (anyTimeout && !watchdog_) {
+                watchdog_ = std::make_unique<Watchdog>(dumpStacks_,
+                        [this, &slices, &finishSlice](
+                                Watchdog::Slot& slot, TestResult&& result) {
+                    const Slice& slice =
+                        *static_cast<const Slice*>(slot.context.load());
+                    abandonedThreads_ = true;
+                    budget::gate().abandon(slot.thread);
+                    metrics_.runsFinished(result);
+                    if (failFast_) {
+                        stopRequested_ = true;
+                    }
+                    // Before the replacement, which is what keeps the pool's
+                    // run() (and so the slices) from finishing underneath
+                    finishSlice(&slice - slices.data(), std::move(result));
+                    pool_.replaceWorker(slot.worker.load());
+                });
+            }
+
+            pool_.run(slices.size(),
+                    [this, &slices, &finishSlice](size_t task, size_t worker) {
+                if (watchdog_ && !watchdogSlot_) {
+                    watchdogSlot_ = watchdog_->newSlot();
+                }
+                if (trace::Recorder* recorder = trace::Recorder::active()) {
+                    recorder->nameThread("worker " + std::to_string(worker));
+                }
+                slices[task].worker = worker;
+                std::optional<TestResult> result =
+                    runSlice(slices[task], true);
+                if (result) {
+                    finishSlice(task, std::move(*result));
+                }
+            });
+        }
+    }
+
+    /* Runs the TEST_ASYNCs, once the other tests are done, on one event loop
+     * per worker (or fewer, if there are fewer tests). Every test on a loop
+     * starts at once, and they're dealt out round robin so the loops get an
+     * even share. They always run in-process, even with --isolate, and only
+     * once, whatever --repeat says. Tests on a loop share a thread, so --perf
+     * can't tell them apart and doesn't count them. A test that blocks its
+     * loop's thread past its timeout takes the rest of that loop down with
+     * it, and the thread is replaced.
+     */
+    void runAsyncTests(const std::vector<const TestDescriptor*>& tests) {
+        if (tests.empty()) {
+            return;
+        }
+        if (stopRequested_) {
+            numSkipped_ += tests.size();
+            return;
+        }
+
+        const bool anyTimeout = std::any_of(tests.begin(), tests.end(),
+                [this](const TestDescriptor* test) {
+            return timeoutMs(*test) > 0;
+        });
+        if (anyTimeout && !watchdog_) {
+            // Every resume the loops have watched brings its own onTimeout
+            watchdog_ = std::make_unique<Watchdog>(dumpStacks_,
+                    Watchdog::TimeoutFunc());
+        }
+
+        const size_t numLoops = std::min(pool_.size(), tests.size());
+        pool_.run(numLoops, [this, &tests, numLoops](size_t task,
+                    size_t worker) {
+            if (watchdog_ && !watchdogSlot_) {
+                watchdogSlot_ = watchdog_->newSlot();
+            }
+            if (trace::Recorder* recorder = trace::Recorder::active()) {
+                recorder->nameThread("event loop " + std::to_string(task));
+            }
+            eventloop::EventLoop loop(
+                    [this](const TestDescriptor& test, TestResult&& result) {
+                metrics_.runsFinished(result);
+                if (result.status != TestResult::s_passed && failFast_) {
+                    stopRequested_ = true;
+                }
+                report(test, std::move(result));
+            });
+            if (watchdogSlot_) {
+                // A resume that blocks past its test's deadline
+                loop.watchWith(watchdogSlot_, worker,
+                        [this](Watchdog::Slot& slot) {
+                    abandonedThreads_ = true;
+                    budget::gate().abandon(slot.thread);
+                    pool_.replaceWorker(slot.worker.load());
+                });
+            }
+            for (size_t i = task; i < tests.size(); i += numLoops) {
+                loop.add(*tests[i], timeoutMs(*tests[i]));
+                metrics_.runsStarted();
+            }
+            loop.run();
+        });
+    }
+
+    // Reports a test whose runs have all finished, or counts it as skipped
+    // if it never got to run
+    void finish(const TestDescriptor& test, TestResult&& result) {
+        if (result.runs == 0) {
+            std::lock_guard lg(dataMutex_);
+            ++numSkipped_;
+            return;
+        }
+        report(test, std::move(result));
+    }
+
+    void report(const TestDescriptor& test, TestResult&& result) {
+        {
+            std::lock_guard lg(dataMutex_);
+            if (result.status == TestResult::s_timedOut) {
+                timedOut_.push_back(test.name);
+            } else if (result.status != TestResult::s_passed) {
+                failed_.push_back(test.name);
+            }
+            timings_.push_back(
+                    TestTiming{test.name, result.wallMs, result.cpuMs});
+            statuses_.emplace_back(&test, result.status);
+        }
+        metrics_.testReported(result.status);
+
+        const bool parameterized = test.runCase != nullptr;
+        const bool repeated = result.runs > 1
+            || (!parameterized && (test.repeat > 1 || repeat_ > 1));
+        reporter_.testFinished(TestReport{test.name, test.file, test.line,
+                repeated, parameterized, std::move(result)});
+    }
+
+    /* Moves the tests that took longest last time to the front. The pool
+     * starts tasks in order, so the slow ones begin right away instead of
+     * being the last thing running at the end. Tests without history go first
+     * since they could be slow too.
+     */
+    void scheduleLongestFirst(
+            std::vector<const TestDescriptor*>& tests) const {
+        if (history_.empty()) {
+            return;
+        }
+
+        std::stable_sort(tests.begin(), tests.end(),
+                [this](const auto& a, const auto& b) {
+            double aMs = history_.durationMs(a->name);
+            double bMs = history_.durationMs(b->name);
+            if (aMs < 0 || bMs < 0) {
+                return aMs < 0 && bMs >= 0;
+            }
+            return aMs > bMs;
+        });
+    }
+
+    void printSlowest() {
+        if (numSlowest_ == 0 || timings_.empty()) {
+            return;
+        }
+
+        std::sort(timings_.begin(), timings_.end(),
+                [](const TestTiming& a, const TestTiming& b) {
+            return a.wallMs > b.wallMs;
+        });
+        size_t count = std::min(numSlowest_, timings_.size());
+        std::cout << std::endl << "Slowest " << count << " tests:" << std::endl;
+        for (size_t i = 0; i < count; ++i) {
+            char line[64];
+            std::snprintf(line, sizeof(line), "    %10.3f ms wall %10.3f ms cpu  ",
+                    timings_[i].wallMs, timings_[i].cpuMs);
+            std::cout << line << timings_[i].name << std::endl;
+        }
+    }
+
+    struct TestTiming {
+        std::string name;
+        double wallMs;
+        double cpuMs;
+    };
+
+    Tests tests_;
+    WorkerPool pool_;
+    TestHistory history_;
+    ResultCache results_;
+    bool failedFirst_;
+    size_t numSlowest_;
+    bool isolate_;
+    size_t repeat_;
+    size_t concurrency_;
+    bool failFast_;
+    double timeoutSec_;
+    uint64_t seed_;
+    bool dumpStacks_;
+    bool perf_;
+    bool perfHardware_;
+    std::atomic<bool> stopRequested_{false};
+    // Kept until the runner goes, since abandoned threads may still use
+    // their slots whenever their test returns
+    std::unique_ptr<Watchdog> watchdog_;
+    inline static thread_local Watchdog::Slot* watchdogSlot_ = nullptr;
+    std::atomic<bool> abandonedThreads_{false};
+    size_t numSkipped_ = 0;
+    std::vector<TestTiming> timings_;
+    std::vector<std::pair<const TestDescriptor*, TestResult::Status>> statuses_;
+    Reporter reporter_;
+    telemetry::Metrics metrics_;
+    // Declared after metrics_, which its thread reads until it's gone
+    std::unique_ptr<telemetry::Exporter> exporter_;
+    std::mutex dataMutex_;
+    std::vector<std::string> failed_;
+    std::vector<std::string> timedOut_;
+};
+
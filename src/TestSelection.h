@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Hash.h"
+#include "Options.h"
+#include "ResultCache.h"
+#include "TestHistory.h"
+#include "TestRegistry.h"
+
+/* Picks which of the registered tests this process runs, before anything is
+ * scheduled:
+ *   --filter / --exclude  glob patterns on the test name (* and ?), several
+ *                         patterns can be given comma separated or by
+ *                         repeating the flag
+ *   --shard-index / --shard-count
+ *                         split the suite across processes or machines. By
+ *                         default a test's shard comes from a hash of its
+ *                         name, so it never moves when other tests are added.
+ *   --shard-balance       assign shards from the recorded durations instead,
+ *                         so each shard takes about as long. Every shard must
+ *                         read the same history file for the split to line
+ *                         up.
+ *   --only-failed / --skip-unchanged
+ *                         narrow a shard down using the results of the last
+ *                         run (see ResultCache.h)
+ */
+namespace selection {
+
+// Matches the whole name. * is any run of characters, ? any one character.
+inline bool globMatch(const std::string& pattern, const std::string& name) {
+    size_t p = 0, n = 0;
+    size_t starP = std::string::npos, starN = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            ++p;
+            ++n;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starN = n;
+        } else if (starP != std::string::npos) {
+            // Let the last * swallow one more character and retry
+            p = starP + 1;
+            n = ++starN;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+inline bool matchesAny(
+        const std::vector<std::string>& patterns, const std::string& name) {
+    return std::any_of(patterns.begin(), patterns.end(),
+            [&name](const std::string& pattern) {
+        return globMatch(pattern, name);
+    });
+}
+
+/* Greedy longest-first assignment: each test goes to whichever shard has the
+ * least total time so far. Tests without history are assumed to take the
+ * average of the ones with history.
+ */
+inline std::vector<size_t> balancedShards(
+        const Tests& tests, size_t shardCount, const TestHistory& history) {
+    double known = 0;
+    size_t numKnown = 0;
+    for (const auto& test : tests) {
+        double ms = history.durationMs(test.name);
+        if (ms >= 0) {
+            known += ms;
+            ++numKnown;
+        }
+    }
+    const double guess = numKnown ? known / numKnown : 1;
+
+    std::vector<std::pair<double, size_t>> order;
+    for (size_t i = 0; i < tests.size(); ++i) {
+        double ms = history.durationMs(tests[i].name);
+        order.emplace_back(ms >= 0 ? ms : guess, i);
+    }
+    // Ties broken by position, which is name order, so every shard computes
+    // the same assignment
+    std::sort(order.begin(), order.end(),
+            [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    std::vector<double> load(shardCount, 0);
+    std::vector<size_t> shards(tests.size());
+    for (const auto& entry : order) {
+        size_t lightest = std::min_element(load.begin(), load.end())
+            - load.begin();
+        shards[entry.second] = lightest;
+        load[lightest] += entry.first;
+    }
+    return shards;
+}
+
+inline Tests selectTests(
+        Tests tests, const RunOptions& opts, const TestHistory& history) {
+    if (opts.shardIndex >= opts.shardCount) {
+        throw std::runtime_error("--shard-index must be less than --shard-count");
+    }
+
+    tests.erase(std::remove_if(tests.begin(), tests.end(),
+            [&opts](const TestDescriptor& test) {
+        return (!opts.filters.empty() && !matchesAny(opts.filters, test.name))
+            || matchesAny(opts.excludes, test.name);
+    }), tests.end());
+
+    if (opts.shardCount <= 1) {
+        return tests;
+    }
+
+    std::vector<size_t> shards;
+    if (opts.shardBalance) {
+        shards = balancedShards(tests, opts.shardCount, history);
+    } else {
+        for (const auto& test : tests) {
+            shards.push_back(hashing::stableHash(test.name) % opts.shardCount);
+        }
+    }
+
+    Tests selected;
+    for (size_t i = 0; i < tests.size(); ++i) {
+        if (shards[i] == opts.shardIndex) {
+            selected.push_back(std::move(tests[i]));
+        }
+    }
+    return selected;
+}
+
+/* Applies --only-failed and --skip-unchanged. This comes after sharding, so
+ * which shard a test is in doesn't depend on how it did last time. Returns
+ * the number of tests left out as unchanged.
+ */
+inline size_t selectByResults(
+        Tests& tests, const RunOptions& opts, ResultCache& cache) {
+    if (opts.onlyFailed && cache.anyFailed()) {
+        tests.erase(std::remove_if(tests.begin(), tests.end(),
+                [&cache](const TestDescriptor& test) {
+            return !cache.failedLastTime(test.name);
+        }), tests.end());
+    }
+
+    if (!opts.skipUnchanged) {
+        return 0;
+    }
+    const size_t before = tests.size();
+    tests.erase(std::remove_if(tests.begin(), tests.end(),
+            [&cache](const TestDescriptor& test) {
+        return cache.unchangedSincePass(test);
+    }), tests.end());
+    return before - tests.size();
+}
+
+} // namespace selection
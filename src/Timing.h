@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+
+namespace timing {
+
+// CPU time consumed by the calling thread, in milliseconds
+inline double threadCpuMs() {
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// steady_clock now, in milliseconds since its (arbitrary) epoch
+inline double steadyMs() {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Measures wall clock and thread CPU time from construction. Both readings
+ * must be taken on the thread that created the Stopwatch for the CPU time to
+ * mean anything.
+ */
+class Stopwatch {
+  public:
+    Stopwatch()
+        : wallStart_(std::chrono::steady_clock::now()),
+          cpuStart_(threadCpuMs()) {
+    }
+
+    double wallMs() const {
+        return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - wallStart_).count();
+    }
+
+    double cpuMs() const {
+        return threadCpuMs() - cpuStart_;
+    }
+
+  private:
+    std::chrono::steady_clock::time_point wallStart_;
+    double cpuStart_;
+};
+
+} // namespace timing
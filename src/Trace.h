@@ -0,0 +1,291 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Allocations.h"
+#include "PrintHelpers.h"
+#include "TestResult.h"
+#include "Timing.h"
+
+/* --trace out.json: a timeline of the run in the Chrome trace event format,
+ * for chrome://tracing or ui.perfetto.dev. Every test is a span on the lane
+ * of the worker thread that ran it, next to the phases of the run on the
+ * main thread, the reporter's writes, and anything that waited on the budget
+ * gate. Idle workers and a serial tail at the end are easy to spot.
+ *
+ * With --isolate the tests run in other processes, so the parent draws each
+ * slice on a lane per worker process from the times its result came back
+ * with. TEST_ASYNCs show up twice: as async spans from start to finish, and
+ * as the individual resumes on their event loop's thread.
+ *
+ * Each thread records into a buffer of its own, which only that thread
+ * appends to. The buffer's mutex is only there for the one time it's read,
+ * at the end, in case a timed out test's thread is still going.
+ */
+namespace trace {
+
+class Recorder {
+  public:
+    explicit Recorder(std::string path)
+        : path_(std::move(path)), startMs_(timing::steadyMs()) {
+        active_ = this;
+    }
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    ~Recorder() {
+        active_ = nullptr;
+    }
+
+    // The recorder for this run, or null if it isn't being traced
+    static Recorder* active() {
+        return active_;
+    }
+
+    // Labels the calling thread's lane
+    void nameThread(std::string name) {
+        Buffer& buffer = threadBuffer();
+        std::lock_guard lock(buffer.mutex);
+        alloc::Pause pause;
+        buffer.name = std::move(name);
+    }
+
+    void begin(const char* category, std::string name) {
+        record(Event{'B', category, std::move(name), nowUs(), 0, 0, nullptr});
+    }
+
+    // Ends the calling thread's innermost span. status, if given, is shown
+    // with it.
+    void end(const char* status = nullptr) {
+        record(Event{'E', nullptr, std::string(), nowUs(), 0, 0, status});
+    }
+
+    // A span on the calling thread that's already over, for when whether
+    // it's worth recording is only known at the end
+    void complete(const char* category, std::string name, double startMs,
+            double endMs) {
+        record(Event{'X', category, std::move(name), toUs(startMs),
+            toUs(endMs) - toUs(startMs), 0, nullptr});
+    }
+
+    // A span of another process, drawn on a lane of its own
+    void completeOnLane(const char* category, std::string name, size_t lane,
+            double startMs, double endMs, const char* status) {
+        Event event{'X', category, std::move(name), toUs(startMs),
+            toUs(endMs) - toUs(startMs), 0, status};
+        event.lane = lane;
+        record(std::move(event));
+    }
+
+    // A span that can cross others on the same thread, matched up by id
+    void asyncBegin(const char* category, std::string name, uint64_t id) {
+        record(Event{'b', category, std::move(name), nowUs(), 0, id, nullptr});
+    }
+
+    void asyncEnd(const char* category, std::string name, uint64_t id,
+            const char* status) {
+        record(Event{'e', category, std::move(name), nowUs(), 0, id, status});
+    }
+
+    void write() {
+        std::ofstream out(path_, std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Couldn't write the trace to " + path_);
+        }
+        const std::string pid = std::to_string(getpid());
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"args\": {\"name\": \"tests\"}}";
+
+        std::lock_guard lock(buffersMutex_);
+        for (const auto& buffer : buffers_) {
+            std::lock_guard bufferLock(buffer->mutex);
+            out << ",\n";
+            writeThreadName(out, pid, buffer->tid,
+                    buffer->name.empty() ? "thread " + std::to_string(buffer->tid)
+                        : buffer->name);
+            for (const Event& event : buffer->events) {
+                if (event.lane != ownThread) {
+                    continue;
+                }
+                out << ",\n";
+                writeEvent(out, pid, buffer->tid, event);
+            }
+        }
+        // Lanes for worker processes, numbered after every real thread
+        std::vector<bool> lanes;
+        for (const auto& buffer : buffers_) {
+            std::lock_guard bufferLock(buffer->mutex);
+            for (const Event& event : buffer->events) {
+                if (event.lane == ownThread) {
+                    continue;
+                }
+                const int tid = laneTid(event.lane);
+                if (event.lane >= lanes.size()) {
+                    lanes.resize(event.lane + 1);
+                }
+                if (!lanes[event.lane]) {
+                    lanes[event.lane] = true;
+                    out << ",\n";
+                    writeThreadName(out, pid, tid,
+                            "worker process " + std::to_string(event.lane));
+                }
+                out << ",\n";
+                writeEvent(out, pid, tid, event);
+            }
+        }
+        out << "\n]}\n";
+    }
+
+  private:
+    // The lane of events that aren't from another process
+    static constexpr size_t ownThread = static_cast<size_t>(-1);
+
+    struct Event {
+        char phase;
+        const char* category;
+        std::string name;
+        double ts;
+        double dur;
+        uint64_t id;
+        const char* status;
+        size_t lane = ownThread;
+    };
+
+    struct Buffer {
+        std::mutex mutex;
+        int tid = 0;
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    double toUs(double ms) const {
+        return (ms - startMs_) * 1000;
+    }
+
+    double nowUs() const {
+        return toUs(timing::steadyMs());
+    }
+
+    int laneTid(size_t lane) const {
+        return static_cast<int>(buffers_.size() + 1 + lane);
+    }
+
+    void record(Event&& event) {
+        Buffer& buffer = threadBuffer();
+        std::lock_guard lock(buffer.mutex);
+        alloc::Pause pause;
+        buffer.events.push_back(std::move(event));
+    }
+
+    // Made on a thread's first event, and kept by the recorder so it
+    // outlives the thread
+    Buffer& threadBuffer() {
+        thread_local Recorder* owner = nullptr;
+        thread_local Buffer* buffer = nullptr;
+        if (owner != this) {
+            alloc::Pause pause;
+            std::lock_guard lock(buffersMutex_);
+            buffers_.push_back(std::make_unique<Buffer>());
+            buffer = buffers_.back().get();
+            buffer->tid = static_cast<int>(buffers_.size());
+            owner = this;
+        }
+        return *buffer;
+    }
+
+    static void writeThreadName(std::ostream& out, const std::string& pid,
+            int tid, const std::string& name) {
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"tid\": " << tid << ", \"args\": {\"name\": \""
+            << print::escapeJson(name) << "\"}},\n"
+            << "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": "
+            << pid << ", \"tid\": " << tid << ", \"args\": {\"sort_index\": "
+            << tid << "}}";
+    }
+
+    static void writeEvent(std::ostream& out, const std::string& pid, int tid,
+            const Event& event) {
+        char ts[64];
+        std::snprintf(ts, sizeof(ts), "%.3f", event.ts);
+        out << "{\"ph\": \"" << event.phase << "\", \"pid\": " << pid
+            << ", \"tid\": " << tid << ", \"ts\": " << ts;
+        if (event.phase != 'E') {
+            out << ", \"cat\": \"" << event.category << "\", \"name\": \""
+                << print::escapeJson(event.name) << "\"";
+        }
+        if (event.phase == 'X') {
+            std::snprintf(ts, sizeof(ts), "%.3f", event.dur);
+            out << ", \"dur\": " << ts;
+        }
+        if (event.phase == 'b' || event.phase == 'e') {
+            out << ", \"id\": " << event.id;
+        }
+        if (event.status) {
+            out << ", \"args\": {\"status\": \"" << event.status << "\"}";
+        }
+        out << "}";
+    }
+
+    std::string path_;
+    double startMs_;
+    std::mutex buffersMutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+
+    inline static std::atomic<Recorder*> active_{nullptr};
+};
+
+/* Records the calling thread's time between here and the end of the scope,
+ * if the run is being traced
+ */
+class Span {
+  public:
+    Span(const char* category, std::string name)
+        : recorder_(Recorder::active()) {
+        if (recorder_) {
+            recorder_->begin(category, std::move(name));
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+        if (recorder_) {
+            recorder_->end(status_);
+        }
+    }
+
+    // Shown with the span once it ends. Has to outlive the span.
+    void setStatus(const char* status) {
+        status_ = status;
+    }
+
+  private:
+    Recorder* recorder_;
+    const char* status_ = nullptr;
+};
+
+// How a test ended, as shown with its span
+inline const char* statusName(TestResult::Status status) {
+    switch (status) {
+        case TestResult::s_passed: return "passed";
+        case TestResult::s_failed: return "failed";
+        case TestResult::s_crashed: return "crashed";
+        case TestResult::s_timedOut: return "timed out";
+    }
+    return "unknown";
+}
+
+} // namespace trace
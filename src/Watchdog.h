@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+
+#include "StackDump.h"
+#include "TestPrinter.h"
+#include "TestResult.h"
+#include "Timing.h"
+
+/* One thread that watches every test running in-process and steps in when
+ * one runs past its deadline.
+ *
+ * Each worker thread has a Slot. It calls begin() before a test and end()
+ * after. The watchdog wakes up every few milliseconds, and when a slot has
+ * been running too long it claims it (running -> timed out), so the test
+ * can't also report itself if it does finish later. It then parks the
+ * thread in a signal handler (see StackDump.h), copies whatever output the
+ * test has captured so far and, if asked to, its stack, and hands the result
+ * to onTimeout. A thread that won't park (blocking the signal, say) could
+ * still be writing, and one parked partway through an append has left its
+ * output half updated, so in either case the output is left out. The stuck
+ * thread is never touched again: onTimeout is expected to give its work to a
+ * new thread. If the test ever does return, end() tells it to get out of the
+ * way.
+ *
+ * A slot's fields change on every begin() while the watchdog may be reading
+ * them, so the state carries a generation that begin() bumps. The watchdog
+ * only claims a slot if the generation it read the deadline under is still
+ * the current one; otherwise it has mixed up two begin()s and lets it be.
+ */
+class Watchdog {
+  public:
+    struct Slot {
+        enum State {
+            s_idle,
+            s_running,
+            // Claimed by the watchdog, which is still reporting it
+            s_timedOut,
+            // Reported; the thread running it has been replaced
+            s_abandoned,
+        };
+
+        // The generation in the high bits, the State in the low two
+        std::atomic<uint64_t> state{s_idle};
+        pthread_t thread;
+        std::atomic<size_t> worker{0};
+        // Whatever the caller needs in onTimeout to finish the test off
+        std::atomic<const void*> context{nullptr};
+        std::atomic<TestCapture*> capture{nullptr};
+        std::atomic<double> startMs{0};
+        std::atomic<double> timeoutMs{0};
+        // Called instead of the watchdog's own onTimeout, if set
+        std::atomic<const std::function<void(Slot& slot, TestResult&& result)>*>
+            onTimeout{nullptr};
+
+        static constexpr uint64_t stateMask = 3;
+
+        static int stateOf(uint64_t state) {
+            return static_cast<int>(state & stateMask);
+        }
+
+        static uint64_t withState(uint64_t state, int newState) {
+            return (state & ~stateMask) | static_cast<uint64_t>(newState);
+        }
+    };
+
+    typedef std::function<void(Slot& slot, TestResult&& result)> TimeoutFunc;
+
+    Watchdog(bool dumpStacks, TimeoutFunc onTimeout)
+        : dumpStacks_(dumpStacks), onTimeout_(std::move(onTimeout)) {
+        stackdump::install(false);
+        thread_ = std::thread([this]() { watch(); });
+    }
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    ~Watchdog() {
+        {
+            std::lock_guard lg(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    // A slot for the calling thread. It stays valid until the watchdog is
+    // destroyed, even if the thread is abandoned.
+    Slot* newSlot() {
+        std::lock_guard lg(mutex_);
+        slots_.emplace_back();
+        slots_.back().thread = pthread_self();
+        return &slots_.back();
+    }
+
+    // No timeout if timeoutMs is 0. onTimeout, if given, is called in place
+    // of the watchdog's own, and has to outlive the slot's thread.
+    static void begin(Slot* slot, size_t worker, const void* context,
+            TestCapture* capture, double timeoutMs,
+            const TimeoutFunc* onTimeout = nullptr) {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        slot->worker.store(worker, relaxed);
+        slot->context.store(context, relaxed);
+        slot->capture.store(capture, relaxed);
+        slot->timeoutMs.store(timeoutMs, relaxed);
+        slot->onTimeout.store(onTimeout, relaxed);
+        slot->startMs.store(timing::steadyMs(), relaxed);
+        // Only this thread moves an idle slot on, so there's no race here
+        const uint64_t idle = slot->state.load(relaxed);
+        slot->state.store(((idle | Slot::stateMask) + 1) | Slot::s_running,
+                std::memory_order_release);
+    }
+
+    /* Returns false if the watchdog got there first. The test has then been
+     * reported as timed out and this thread replaced, so the caller must drop
+     * what it has and return. This waits until the replacement is in place.
+     */
+    static bool end(Slot* slot) {
+        uint64_t running = slot->state.load(std::memory_order_acquire);
+        if (Slot::stateOf(running) == Slot::s_running
+                && slot->state.compare_exchange_strong(running,
+                    Slot::withState(running, Slot::s_idle))) {
+            return true;
+        }
+        while (Slot::stateOf(slot->state.load(std::memory_order_acquire))
+                != Slot::s_abandoned) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+  private:
+    void watch() {
+        std::unique_lock lock(mutex_);
+        while (!stopping_) {
+            wake_.wait_for(lock, std::chrono::milliseconds(5));
+            const double now = timing::steadyMs();
+            // By index, since slots can be added while the lock is released
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                Slot& slot = slots_[i];
+                uint64_t running = slot.state.load(std::memory_order_acquire);
+                if (Slot::stateOf(running) != Slot::s_running) {
+                    continue;
+                }
+                // Maybe from a later begin() than running; the exchange
+                // below fails if so
+                const double timeoutMs = slot.timeoutMs.load();
+                if (timeoutMs > 0 && now - slot.startMs.load() > timeoutMs) {
+                    if (slot.state.compare_exchange_strong(running,
+                                Slot::withState(running, Slot::s_timedOut))) {
+                        // The replacement thread calls newSlot()
+                        lock.unlock();
+                        timeOut(slot, now);
+                        lock.lock();
+                    }
+                }
+            }
+        }
+    }
+
+    // The slot is claimed, so its thread can't begin() again underneath this
+    void timeOut(Slot& slot, double now) {
+        const bool stopped = stackdump::stop(slot.thread, 500);
+
+        const double startMs = slot.startMs.load();
+        TestCapture* capture = slot.capture.load();
+        TestResult result;
+        result.fail(TestResult::s_timedOut,
+                TestResult::describeTimeout(slot.timeoutMs.load()));
+        result.startMs = startMs;
+        result.endMs = now;
+        result.wallMs = now - startMs;
+        if (capture && !stopped) {
+            result.err = "(The test's output isn't shown: its thread didn't "
+                "stop to have it copied.)\n";
+        } else if (capture && capture->writing()) {
+            result.err = "(The test's output isn't shown: it was stopped "
+                "partway through writing some.)\n";
+        } else if (capture) {
+            result.out = capture->snapshot(TestCapture::c_out);
+            result.err = capture->snapshot(TestCapture::c_err);
+        }
+        if (stopped && dumpStacks_) {
+            result.err += "Stack of the stuck thread:\n" + stackdump::stack();
+        }
+        stackdump::release();
+
+        const TimeoutFunc* onTimeout = slot.onTimeout.load();
+        (onTimeout ? *onTimeout : onTimeout_)(slot, std::move(result));
+        slot.state.store(Slot::withState(slot.state.load(), Slot::s_abandoned),
+                std::memory_order_release);
+    }
+
+    bool dumpStacks_;
+    TimeoutFunc onTimeout_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    // A deque so slots never move once handed out
+    std::deque<Slot> slots_;
+    std::thread thread_;
+};
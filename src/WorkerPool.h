@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed number of worker threads that share a batch of tasks.
+ *
+ * Every worker owns a deque. Tasks are dealt out round-robin up front, and a
+ * worker takes from the front of its own deque so tasks start in the order
+ * they were submitted. A worker whose deque runs dry steals from the back of
+ * the other deques, which keeps every core busy when some tasks are much
+ * slower than others.
+ *
+ * Each deque has its own mutex. Owners and thieves only collide on the same
+ * deque near the end of a run, so the locks are almost never contended.
+ *
+ * A worker stuck in a task can be swapped for a fresh thread with
+ * replaceWorker(), so one hung test doesn't hold up the rest of the run.
+ */
+class WorkerPool {
+  public:
+    typedef std::function<void(size_t task, size_t worker)> TaskFunc;
+
+    // 0 workers means one per hardware thread
+    explicit WorkerPool(size_t numWorkers) : numWorkers_(numWorkers) {
+        if (numWorkers_ == 0) {
+            numWorkers_ = std::max(1u, std::thread::hardware_concurrency());
+        }
+    }
+
+    size_t size() const {
+        return numWorkers_;
+    }
+
+    // Runs func once for every task in [0, numTasks) and returns when they
+    // have all finished.
+    void run(size_t numTasks, const TaskFunc& func) {
+        if (numTasks == 0) {
+            return;
+        }
+
+        Run state;
+        state.func = &func;
+        const size_t numThreads = std::min(numWorkers_, numTasks);
+        for (size_t i = 0; i < numThreads; ++i) {
+            state.queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for (size_t task = 0; task < numTasks; ++task) {
+            state.queues[task % numThreads]->tasks.push_back(task);
+        }
+
+        {
+            std::lock_guard lg(runMutex_);
+            run_ = &state;
+            for (size_t worker = 0; worker < numThreads; ++worker) {
+                state.threads.push_back(startWorker(state, worker));
+            }
+            state.live = numThreads;
+        }
+
+        // Waits on a count rather than joining, since an abandoned thread
+        // may never finish
+        std::unique_lock lock(runMutex_);
+        state.done.wait(lock, [&state]() { return state.live == 0; });
+        run_ = nullptr;
+        for (auto& thread : state.threads) {
+            thread.thread.join();
+        }
+    }
+
+    /* For a worker stuck in a task that will never finish (see Watchdog):
+     * detaches its thread and starts a new one that carries on with the
+     * worker's queue. If the old thread ever returns from the task, it exits
+     * without touching anything. Only valid while run() is running.
+     */
+    void replaceWorker(size_t worker) {
+        std::lock_guard lg(runMutex_);
+        if (!run_) {
+            return;
+        }
+        WorkerThread& old = run_->threads[worker];
+        old.abandoned->store(true);
+        old.thread.detach();
+        old = startWorker(*run_, worker);
+    }
+
+  private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    struct WorkerThread {
+        std::thread thread;
+        // Shared with the thread, which can outlive the run if abandoned
+        std::shared_ptr<std::atomic<bool>> abandoned;
+    };
+
+    struct Run {
+        const TaskFunc* func;
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<WorkerThread> threads;
+        // Threads still working that haven't been abandoned
+        size_t live = 0;
+        std::condition_variable done;
+    };
+
+    // Called with runMutex_ held
+    WorkerThread startWorker(Run& state, size_t worker) {
+        auto abandoned = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([this, &state, worker, abandoned]() {
+            size_t task;
+            while (!*abandoned && nextTask(state.queues, worker, task)) {
+                (*state.func)(task, worker);
+            }
+            if (*abandoned) {
+                // state may be gone already
+                return;
+            }
+            std::lock_guard lg(runMutex_);
+            if (!*abandoned && --state.live == 0) {
+                state.done.notify_all();
+            }
+        });
+        return WorkerThread{std::move(thread), std::move(abandoned)};
+    }
+
+    // Nothing is added to the queues once run() starts, so an empty sweep
+    // over every queue means this worker is done.
+    static bool nextTask(
+            std::vector<std::unique_ptr<WorkQueue>>& queues,
+            size_t worker,
+            size_t& task) {
+        {
+            WorkQueue& own = *queues[worker];
+            std::lock_guard lg(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkQueue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard lg(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t numWorkers_;
+    std::mutex runMutex_;
+    Run* run_ = nullptr;
+};
@@ -0,0 +1,62 @@
+#include "../TestFramework.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+TEST_FILE
+
+static std::vector<int> makeTwo() {
+    std::vector<int> a(1);
+    std::vector<int> b(1);
+    return std::vector<int>(a.size() + b.size());
+}
+
+TEST("NoAllocations") {
+    int a = 5;
+    ASSERT_EQ(a, 5);
+}
+
+TEST("OneVector") {
+    std::vector<int> values(100);
+    ASSERT_EQ(values.size(), 100u);
+}
+
+TEST("Peak") {
+    for (int i = 0; i < 3; ++i) {
+        auto block = std::make_unique<char[]>(1000);
+        block[0] = 'a';
+    }
+}
+
+static int* kept;
+
+TEST("Leaks") {
+    kept = new int[4]();
+}
+
+TEST("WithinBudget") {
+    std::vector<int> values(10);
+    ASSERT_MAX_ALLOCS(0, values[3] + 1);
+    ASSERT_MAX_ALLOCS(1);
+}
+
+TEST("OverBudget") {
+    ASSERT_MAX_ALLOCS(2, makeTwo());
+}
+
+TEST("OverTestBudget") {
+    std::vector<int> a(1);
+    std::vector<int> b(1);
+    ASSERT_MAX_ALLOCS(1);
+}
+
+TEST("OutputIsNotCounted") {
+    std::cout << std::string(1000, 'x').size() << std::endl;
+}
+
+TEST("ArenaIsNotCounted") {
+    test::arena().allocate(1 << 20);
+}
+
+END_TEST_FILE
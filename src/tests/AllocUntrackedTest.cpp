@@ -0,0 +1,14 @@
+#include "../TestFramework.h"
+
+#include <vector>
+
+TEST_FILE
+
+// Linked without libtestframework_allocs.a, so nothing is counted and a
+// budget can't be checked
+TEST("BudgetNeedsHooks") {
+    std::vector<int> values(100);
+    ASSERT_MAX_ALLOCS(0, values.push_back(1));
+}
+
+END_TEST_FILE
@@ -0,0 +1,2 @@
+./test --no-history
+./test --no-history --allocs
@@ -27,4 +27,22 @@ TEST("AssertEqual") {
     ASSERT_EQ(7, 5);
 }
 
+TEST("AssertEqualMixedTypes") {
+    ASSERT_EQ(5, 5L);
+    ASSERT_EQ(std::string("asf"), "asf");
+    ASSERT_EQ(2.5, 2.5f);
+    ASSERT_EQ(std::string("abc"), "abd", "strings differ");
+}
+
+TEST("AssertEqualNotPrintable") {
+    ASSERT_EQ(Lol(), Lol());
+}
+
+TEST("AssertEqualNullStrings") {
+    const char* none = nullptr;
+    const char* alsoNone = nullptr;
+    ASSERT_EQ(none, alsoNone);
+    ASSERT_EQ(none, "asf");
+}
+
 END_TEST_FILE
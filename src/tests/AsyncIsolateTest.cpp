@@ -0,0 +1,183 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+
+TEST_FILE
+
+using namespace std::chrono_literals;
+
+/* Async tests under --isolate still run in-process, on several event loops
+ * at once, and all of them report while the reporter has no writer thread.
+ * They all wake at once, and every fourth fails with some output, so the
+ * console has whole blocks that would come out interleaved if two loops
+ * wrote at the same time.
+ */
+TEST_ASYNC("Async00") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(0, 0);
+}
+
+TEST_ASYNC("Async01") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(1, 1);
+}
+
+TEST_ASYNC("Async02") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(2, 2);
+}
+
+TEST_ASYNC("Async03") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 03\n";
+    ASSERT_EQ(3, 0);
+}
+
+TEST_ASYNC("Async04") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(4, 4);
+}
+
+TEST_ASYNC("Async05") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(5, 5);
+}
+
+TEST_ASYNC("Async06") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(6, 6);
+}
+
+TEST_ASYNC("Async07") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 07\n";
+    ASSERT_EQ(7, 0);
+}
+
+TEST_ASYNC("Async08") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(8, 8);
+}
+
+TEST_ASYNC("Async09") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(9, 9);
+}
+
+TEST_ASYNC("Async10") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(10, 10);
+}
+
+TEST_ASYNC("Async11") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 11\n";
+    ASSERT_EQ(11, 0);
+}
+
+TEST_ASYNC("Async12") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(12, 12);
+}
+
+TEST_ASYNC("Async13") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(13, 13);
+}
+
+TEST_ASYNC("Async14") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(14, 14);
+}
+
+TEST_ASYNC("Async15") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 15\n";
+    ASSERT_EQ(15, 0);
+}
+
+TEST_ASYNC("Async16") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(16, 16);
+}
+
+TEST_ASYNC("Async17") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(17, 17);
+}
+
+TEST_ASYNC("Async18") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(18, 18);
+}
+
+TEST_ASYNC("Async19") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 19\n";
+    ASSERT_EQ(19, 0);
+}
+
+TEST_ASYNC("Async20") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(20, 20);
+}
+
+TEST_ASYNC("Async21") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(21, 21);
+}
+
+TEST_ASYNC("Async22") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(22, 22);
+}
+
+TEST_ASYNC("Async23") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 23\n";
+    ASSERT_EQ(23, 0);
+}
+
+TEST_ASYNC("Async24") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(24, 24);
+}
+
+TEST_ASYNC("Async25") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(25, 25);
+}
+
+TEST_ASYNC("Async26") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(26, 26);
+}
+
+TEST_ASYNC("Async27") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 27\n";
+    ASSERT_EQ(27, 0);
+}
+
+TEST_ASYNC("Async28") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(28, 28);
+}
+
+TEST_ASYNC("Async29") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(29, 29);
+}
+
+TEST_ASYNC("Async30") {
+    co_await test::sleep(10ms);
+    ASSERT_EQ(30, 30);
+}
+
+TEST_ASYNC("Async31") {
+    co_await test::sleep(10ms);
+    std::cout << "output of 31\n";
+    ASSERT_EQ(31, 0);
+}
+
+END_TEST_FILE
@@ -0,0 +1,30 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+using namespace std::chrono_literals;
+
+// Blocks its event loop's thread outright instead of co_awaiting, so only
+// the watchdog can notice
+TEST_ASYNC("BlocksTheLoop", test::timeout(0.3)) {
+    co_await test::yield();
+    std::cout << "about to block" << std::endl;
+    while (true) {
+        std::this_thread::sleep_for(10ms);
+    }
+}
+
+// Shares the loop, so it can't finish either
+TEST_ASYNC("WaitsItsTurn") {
+    std::cout << "started" << std::endl;
+    co_await test::sleep(2000ms);
+}
+
+TEST("Sync") {
+    ASSERT_TRUE(true);
+}
+
+END_TEST_FILE
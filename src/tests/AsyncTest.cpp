@@ -0,0 +1,74 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+TEST_FILE
+
+using namespace std::chrono_literals;
+
+// Ordinary tests all run before any async one starts
+TEST("Sync") {
+    ASSERT_TRUE(true);
+}
+
+// Each test finishes at its own time, so they're reported in a fixed order
+// however they were started
+
+TEST_ASYNC("PipeRoundTrip") {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    co_await test::sleep(50ms);
+    co_await test::writable(fds[1]);
+    ASSERT_EQ(write(fds[1], "ping", 4), 4);
+    co_await test::readable(fds[0]);
+    char buffer[4];
+    ASSERT_EQ(read(fds[0], buffer, 4), 4);
+    ASSERT_EQ(std::string(buffer, 4), "ping");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_ASYNC("Yields") {
+    int turns = 0;
+    for (int i = 0; i < 3; ++i) {
+        co_await test::yield();
+        ++turns;
+    }
+    co_await test::sleep(100ms);
+    ASSERT_EQ(turns, 3);
+}
+
+static test::Async failsLater() {
+    co_await test::sleep(150ms);
+    throw std::runtime_error("helper gave up");
+}
+
+TEST_ASYNC("AwaitsFailingHelper") {
+    co_await failsLater();
+    std::cout << "not reached" << std::endl;
+}
+
+TEST_ASYNC("ExpectsThenAsserts") {
+    co_await test::yield();
+    EXPECT_EQ(1 + 1, 3);
+    co_await test::sleep(200ms);
+    ASSERT_TRUE(false);
+}
+
+TEST_ASYNC("PrintsThenFails") {
+    std::cout << "before sleeping" << std::endl;
+    co_await test::sleep(250ms);
+    std::cerr << "after sleeping" << std::endl;
+    ASSERT_EQ(2, 3);
+}
+
+TEST_ASYNC("Hangs", test::timeout(0.5)) {
+    std::cout << "about to hang" << std::endl;
+    co_await test::sleep(1h);
+}
+
+END_TEST_FILE
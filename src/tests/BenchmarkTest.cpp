@@ -0,0 +1,19 @@
+#include "../TestFramework.h"
+
+#include <stdexcept>
+
+TEST_FILE
+
+BENCHMARK("Adds") {
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += i;
+    }
+    bench::DoNotOptimize(sum);
+}
+
+BENCHMARK("Throws") {
+    throw std::runtime_error("no <good> & \"bad\"");
+}
+
+END_TEST_FILE
@@ -0,0 +1,9 @@
+# A passing and a failing benchmark: the exit status, the console and the
+# --bench-out file, with the timings masked
+./test --bench --bench-samples 3 --bench-sample-ms 1 --bench-out bench.json \
+    > console.txt
+echo "exit status $?"
+sed -E 's/^    [0-9.]+ ns\/op.*/    TIMING/' console.txt
+sed -E -e 's/"(iterations|[a-z_]+_ns|ns_per_op)": [0-9.e+-]+/"\1": N/g' \
+    -e 's/"samples_ns": \[[^]]*\]/"samples_ns": [N, N, N]/' bench.json
+rm -f console.txt bench.json
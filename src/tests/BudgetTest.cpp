@@ -0,0 +1,61 @@
+#include "../TestFramework.h"
+
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+TEST_FILE
+
+using namespace std::chrono_literals;
+
+static std::vector<int> numbers(1000, 1);
+
+TEST("SumFitsItsBudget") {
+    ASSERT_RUNS_UNDER(100ms, {
+        bench::DoNotOptimize(std::accumulate(numbers.begin(), numbers.end(), 0));
+    });
+    ASSERT_NS_PER_OP_LT(100000, bench::DoNotOptimize(numbers.front()));
+}
+
+TEST("SleepIsOverBudget") {
+    ASSERT_RUNS_UNDER(1us, std::this_thread::sleep_for(1ms));
+}
+
+TEST("SleepIsTooSlowPerOp") {
+    ASSERT_NS_PER_OP_LT(50, std::this_thread::sleep_for(10us));
+}
+
+TEST("FailsInsideTheBlock") {
+    ASSERT_RUNS_UNDER(1s, ASSERT_EQ(numbers.size(), 10u));
+}
+
+// Other tests are held back while a budget is measured, so none of these
+// bodies is ever running when the block looks
+static std::atomic<int> running{0};
+
+static void busy() {
+    ++running;
+    std::this_thread::sleep_for(100ms);
+    --running;
+}
+
+TEST("Busy1") {
+    busy();
+}
+
+TEST("Busy2") {
+    busy();
+}
+
+TEST("Busy3") {
+    busy();
+}
+
+TEST("MeasuresAlone") {
+    std::this_thread::sleep_for(20ms);
+    ASSERT_RUNS_UNDER(1s, ASSERT_EQ(running.load(), 0));
+}
+
+END_TEST_FILE
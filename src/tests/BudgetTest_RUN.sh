@@ -0,0 +1,5 @@
+# Medians change from run to run, so they're masked; whether each budget
+# passes or fails is what's checked
+./test -j 4 | sed -E \
+    -e 's/Median: [0-9.]+(ns|us|ms|s) per op over 15 batches of [0-9]+/Median: N per op over 15 batches of N/' \
+    -e 's/Median: [0-9.]+(ns|us|ms|s) over [0-9]+ runs/Median: N over N runs/'
@@ -0,0 +1,80 @@
+#include "../TestFramework.h"
+
+#include <atomic>
+#include <mutex>
+
+TEST_FILE
+
+static std::atomic<size_t> counter{0};
+static std::atomic<size_t> countersDone{0};
+
+// The last thread of each run checks that every increment landed
+TEST_CONCURRENT("CountsTogether", 8) {
+    for (int i = 0; i < 10000; ++i) {
+        counter.fetch_add(1, std::memory_order_relaxed);
+        test::countOps();
+    }
+    ASSERT_EQ(test::numThreads(), 8);
+    const size_t done = countersDone.fetch_add(1) + 1;
+    if (done % 8 == 0) {
+        ASSERT_EQ(counter.load(), done * 10000);
+    }
+}
+
+static std::atomic<unsigned> seen{0};
+
+TEST_CONCURRENT("EachIndexOnce", 4) {
+    ASSERT_TRUE(test::threadIndex() < test::numThreads());
+    unsigned bit = 1u << test::threadIndex();
+    ASSERT_EQ(seen.fetch_or(bit) & bit, 0u);
+}
+
+static std::mutex mutex;
+static size_t shared = 0;
+static size_t lockersDone = 0;
+
+// The runs are one after another, so the last thread of each one sees every
+// increment so far
+TEST_CONCURRENT("JitteredLocking", 4, test::jitter(), test::repeat(3)) {
+    for (int i = 0; i < 1000; ++i) {
+        std::lock_guard lg(mutex);
+        size_t seen = shared;
+        test::interleave();
+        shared = seen + 1;
+        test::countOps();
+    }
+    std::lock_guard lg(mutex);
+    if (++lockersDone % 4 == 0) {
+        ASSERT_EQ(shared, lockersDone * 1000);
+    }
+}
+
+TEST_CONCURRENT("FailsOnOddThreads", 4) {
+    ASSERT_TRUE(test::threadIndex() % 2 == 0);
+}
+
+TEST_CONCURRENT("ExpectsAndPrints", 3) {
+    std::cout << "hello from thread " << test::threadIndex() << std::endl;
+    EXPECT_EQ(test::threadIndex(), 0u);
+}
+
+TEST("OutsideIsThreadZero") {
+    ASSERT_EQ(test::threadIndex(), 0u);
+    ASSERT_EQ(test::numThreads(), 1u);
+    test::interleave();
+    test::countOps();
+}
+
+// Something that isn't a std::exception fails the test instead of ending
+// the process, on a thread of its own or not
+TEST_CONCURRENT("ThreadThrowsSomethingElse", 2) {
+    if (test::threadIndex() == 1) {
+        throw 42;
+    }
+}
+
+TEST("ThrowsSomethingElse") {
+    throw 42;
+}
+
+END_TEST_FILE
@@ -0,0 +1,4 @@
+# Throughput changes from run to run, so it's masked
+./test -j 1 --seed 5 | sed -E \
+    -e 's/[0-9]+ ops\/s in total, [0-9]+ to [0-9]+ ops\/s/N ops\/s in total, N to N ops\/s/' \
+    -e 's/\(3 runs, [0-9]+ runs\/s\)/(3 runs)/'
@@ -0,0 +1,41 @@
+#include "../TestFramework.h"
+
+#include <string>
+
+TEST_FILE
+
+TEST("AllExpectationsPass") {
+    EXPECT_TRUE(true);
+    EXPECT_FALSE(false);
+    EXPECT_EQ(2 + 2, 4);
+    EXPECT_EQ(std::string("abc"), "abc");
+}
+
+TEST("EveryFailureIsReported") {
+    EXPECT_TRUE(1 > 2);
+    EXPECT_EQ(3, 4, "numbers differ");
+    EXPECT_FALSE(true);
+    std::cout << "still running" << std::endl;
+}
+
+TEST("ExpectThenAssert") {
+    EXPECT_EQ(std::string("abc"), "abd");
+    ASSERT_TRUE(false);
+    EXPECT_TRUE(false);
+}
+
+TEST("ManyFailures") {
+    for (int i = 0; i < 1000000; ++i) {
+        EXPECT_EQ(i % 1000, -1);
+    }
+}
+
+TEST("CollectorIsEmptiedBetweenTests") {
+    EXPECT_TRUE(true);
+}
+
+PROPERTY("ExpectationsShrink", int n, test::ints(0, 1000)) {
+    EXPECT_TRUE(n < 10);
+}
+
+END_TEST_FILE
@@ -0,0 +1,25 @@
+#include "../TestFramework.h"
+
+TEST_FILE
+
+TEST("KeepOne") {
+    ASSERT_TRUE(true);
+}
+
+TEST("KeepTwo") {
+    ASSERT_TRUE(false);
+}
+
+TEST("KeepButExcluded") {
+    ASSERT_TRUE(false);
+}
+
+TEST("Other") {
+    ASSERT_TRUE(false);
+}
+
+TEST("Also?Kept") {
+    ASSERT_TRUE(true);
+}
+
+END_TEST_FILE
@@ -0,0 +1,97 @@
+#include "../TestFramework.h"
+
+#include <stdexcept>
+#include <vector>
+
+TEST_FILE
+
+struct Numbers {
+    Numbers() {
+        ++builds;
+        for (int i = 0; i < 1000; ++i) {
+            values.push_back(i);
+        }
+    }
+
+    std::vector<int> values;
+    static int builds;
+};
+
+int Numbers::builds = 0;
+
+struct NumbersFixture : test::Fixture<Numbers> {
+    NumbersFixture() : first(suite().values.front()) {
+        ++setups;
+    }
+
+    ~NumbersFixture() {
+        ++teardowns;
+    }
+
+    int first;
+    static thread_local int setups;
+    static thread_local int teardowns;
+};
+
+thread_local int NumbersFixture::setups = 0;
+thread_local int NumbersFixture::teardowns = 0;
+
+TEST_F(NumbersFixture, "SuiteBuiltOnce") {
+    ASSERT_EQ(Numbers::builds, 1);
+    ASSERT_EQ(suite().values.size(), 1000u);
+}
+
+TEST_F(NumbersFixture, "SetupRunsPerTest") {
+    ASSERT_EQ(first, 0);
+    // Only this test's fixture is alive on this thread
+    ASSERT_EQ(setups - teardowns, 1);
+}
+
+TEST_F(NumbersFixture, "SharedAcrossTests") {
+    ASSERT_EQ(&suite(), &NumbersFixture::suite());
+    ASSERT_EQ(Numbers::builds, 1);
+}
+
+struct Plain {
+    int value = 7;
+};
+
+TEST_F(Plain, "FixtureWithoutSuite") {
+    ASSERT_EQ(value, 7);
+}
+
+struct Missing {
+    Missing() {
+        throw std::runtime_error("no data");
+    }
+};
+
+struct MissingFixture : test::Fixture<Missing> {
+    MissingFixture() {
+        suite();
+    }
+};
+
+TEST_F(MissingFixture, "SuiteThrows") {
+    ASSERT_TRUE(true);
+}
+
+TEST("ArenaStartsEmpty") {
+    ASSERT_EQ(test::arena().used(), 0u);
+    int* counts = test::arena().make<int>(100);
+    ASSERT_EQ(counts[99], 0);
+    std::vector<int, test::ArenaAllocator<int>> values(test::arena());
+    for (int i = 0; i < 100000; ++i) {
+        values.push_back(i);
+    }
+    ASSERT_EQ(values.back(), 99999);
+}
+
+TEST("ArenaResetBetweenTests") {
+    ASSERT_EQ(test::arena().used(), 0u);
+    void* big = test::arena().allocate(1 << 20);
+    ASSERT_TRUE(big != nullptr);
+    ASSERT_EQ(test::arena().used(), size_t(1 << 20));
+}
+
+END_TEST_FILE
@@ -0,0 +1,31 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../TestFramework.h"
+
+TEST_FILE
+
+TEST("Segfault") {
+    std::cout << "about to crash" << std::endl;
+    std::raise(SIGSEGV);
+}
+
+TEST("Abort") {
+    std::abort();
+}
+
+TEST("Exit") {
+    std::printf("printf output is captured too\n");
+    std::exit(3);
+}
+
+TEST("FailsNormally") {
+    ASSERT_TRUE(false);
+}
+
+TEST("RunsAfterCrashes") {
+    std::cout << "still running" << std::endl;
+}
+
+END_TEST_FILE
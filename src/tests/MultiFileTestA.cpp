@@ -0,0 +1,10 @@
+#include "../TestFramework.h"
+
+TEST("FirstFileTest") {
+    ASSERT_TRUE(true);
+}
+
+TEST("FirstFileFailure") {
+    std::cout << "printed from the first file" << std::endl;
+    ASSERT_EQ(1, 2);
+}
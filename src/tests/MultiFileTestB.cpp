@@ -0,0 +1,9 @@
+#include "../TestFramework.h"
+
+TEST("SecondFileTest") {
+    ASSERT_FALSE(false);
+}
+
+TEST("SecondFileTest2") {
+    ASSERT_TRUE(2 > 1);
+}
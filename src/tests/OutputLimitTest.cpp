@@ -0,0 +1,39 @@
+#include "../TestFramework.h"
+
+#include <cstdio>
+
+TEST_FILE
+
+void printLines(int count) {
+    for (int i = 0; i < count; ++i) {
+        char line[16];
+        std::snprintf(line, sizeof(line), "line %03d", i);
+        std::cout << line << std::endl;
+    }
+}
+
+TEST("ChattyPasses") {
+    printLines(20);
+}
+
+TEST("ChattyFails") {
+    printLines(20);
+    std::cerr << "some errors" << std::endl;
+    ASSERT_EQ(1 + 1, 3);
+}
+
+// Over 200KB, so it goes through several writes to the spill file
+TEST("FloodFails") {
+    for (int i = 0; i < 20000; ++i) {
+        char line[16];
+        std::snprintf(line, sizeof(line), "flood %05d", i);
+        std::cout << line << '\n';
+    }
+    ASSERT_TRUE(false);
+}
+
+TEST("QuietPasses") {
+    std::cout << "short" << std::endl;
+}
+
+END_TEST_FILE
@@ -0,0 +1,27 @@
+# Head and tail from memory and the spill file
+./test --no-history --capture-memory 64 --output-limit 36 -j 1 \
+    --filter ChattyFails,QuietPasses
+
+# Passing output dropped, with the output coming through the process pool
+./test --no-history --isolate --discard-passing-output --capture-memory 64 \
+    --output-limit 36 -j 1 --filter ChattyFails,ChattyPasses
+
+# All of it, read back from the spill file
+./test --no-history --capture-memory 4 --output-limit 0 --filter QuietPasses
+
+# Head and tail read back from a spill file written in chunks, and then the
+# same without a spill file at all, which --discard-passing-output never
+# makes (TMPDIR doesn't exist, so trying would cut the output short)
+./test --no-history --capture-memory 4 --output-limit 40 --filter FloodFails
+TMPDIR=/nonexistent ./test --no-history --discard-passing-output \
+    --capture-memory 120 --output-limit 40 --filter FloodFails
+
+# Passing output dropped with an output limit bigger than the memory, which
+# the head and tail are cut down to fit in
+./test --no-history --discard-passing-output --capture-memory 30 \
+    --output-limit 1000 --filter ChattyFails
+
+# A spill file that can't be made: what didn't fit in memory is lost, and
+# says so
+TMPDIR=/nonexistent ./test --no-history --capture-memory 4 --output-limit 40 \
+    --filter FloodFails
@@ -0,0 +1,24 @@
+#include "../TestFramework.h"
+
+#include <vector>
+
+TEST_FILE
+
+TEST("TouchesMemory") {
+    std::vector<char> pages(16 << 20, 1);
+    ASSERT_EQ(pages.back(), 1);
+}
+
+TEST("Fails") {
+    ASSERT_EQ(1 + 1, 3);
+}
+
+BENCHMARK("Sum") {
+    int sum = 0;
+    for (int i = 0; i < 100; ++i) {
+        sum += i;
+    }
+    bench::DoNotOptimize(sum);
+}
+
+END_TEST_FILE
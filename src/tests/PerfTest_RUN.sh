@@ -0,0 +1,8 @@
+# There may be no PMU to count with, so this sticks to getrusage, and masks
+# the counts
+mask='s/[0-9]+ page faults, [0-9]+ context switches/N page faults, N context switches/'
+
+./test --perf-rusage -j 1 | sed -E "$mask"
+
+./test --bench --perf-rusage --bench-samples 2 --bench-sample-ms 1 \
+    | sed -E -e 's/^    [0-9.]+ ns\/op.*/    TIMING/' -e "$mask"
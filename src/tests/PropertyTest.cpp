@@ -0,0 +1,44 @@
+#include "../TestFramework.h"
+
+#include <algorithm>
+#include <vector>
+
+TEST_FILE
+
+static bool isPrime(int n) {
+    for (int d = 2; d * d <= n; ++d) {
+        if (n % d == 0) {
+            return false;
+        }
+    }
+    return n > 1;
+}
+
+TEST_P("Primes", int n, test::values(2, 3, 5, 7, 11)) {
+    ASSERT_TRUE(isPrime(n));
+}
+
+TEST_P("NotAllPrimes", int n, test::values(2, 4, 5, 9)) {
+    ASSERT_TRUE(isPrime(n));
+}
+
+PROPERTY("SortIsIdempotent", std::vector<int> v,
+        test::vectors(test::ints(-50, 50)), test::cases(200)) {
+    std::sort(v.begin(), v.end());
+    std::vector<int> again = v;
+    std::sort(again.begin(), again.end());
+    ASSERT_TRUE(again == v);
+}
+
+// Fails for anything 20 or over, which shrinks to exactly 20
+PROPERTY("SmallerThanTwenty", int n, test::ints(0, 1000)) {
+    ASSERT_TRUE(n < 20);
+}
+
+// Fails for any vector with a 7 in it, which shrinks to just [7]
+PROPERTY("NoSevens", std::vector<int> v, test::vectors(test::ints(0, 9), 8),
+        test::cases(50)) {
+    ASSERT_TRUE(std::find(v.begin(), v.end(), 7) == v.end());
+}
+
+END_TEST_FILE
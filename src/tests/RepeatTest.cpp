@@ -0,0 +1,45 @@
+#include "../TestFramework.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+TEST_FILE
+
+// Each run adds a line to runs.txt, which the script counts. One write()
+// with O_APPEND, so concurrent runs don't interleave.
+static void logRun(const std::string& name) {
+    int fd = open("runs.txt", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    const std::string line = name + "\n";
+    (void)!write(fd, line.data(), line.size());
+    close(fd);
+}
+
+TEST("Counted") {
+    logRun("Counted");
+}
+
+TEST("RepeatedFive", test::repeat(5)) {
+    logRun("RepeatedFive");
+}
+
+static std::atomic<int> thirdRun{0};
+
+TEST("FailsOnThirdRun") {
+    logRun("FailsOnThirdRun");
+    ASSERT_TRUE(++thirdRun != 3);
+}
+
+TEST("FailsFirst") {
+    logRun("FailsFirst");
+    ASSERT_TRUE(false);
+}
+
+TEST("RunsAfterTheFailure") {
+    logRun("RunsAfterTheFailure");
+}
+
+END_TEST_FILE
@@ -0,0 +1,25 @@
+# Run rates change from run to run, so they're masked
+mask() {
+    sed -E 's/[0-9]+ runs\/s/N runs\/s/'
+}
+
+# How many times each test ran, from the runs.txt its runs write to
+runs() {
+    sort runs.txt | uniq -c | sed -E 's/^ +//'
+    rm -f runs.txt
+}
+
+# --repeat for every test, two runs of each at a time, except where
+# test::repeat says otherwise
+./test --no-history -j 1 --repeat 4 --concurrency 2 \
+    --filter Counted,RepeatedFive | mask
+runs
+
+# --fail-fast stops the runs of a repeated test at the first failure
+./test --no-history -j 1 --repeat 10 --fail-fast --filter FailsOnThirdRun \
+    | mask
+runs
+
+# and stops the run before tests that haven't started
+./test --no-history -j 1 --fail-fast --filter FailsFirst,RunsAfterTheFailure
+runs
@@ -0,0 +1,30 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+TEST("Passes") {
+    std::cout << "fine" << std::endl;
+}
+
+TEST("Fails") {
+    std::cerr << "about to fail" << std::endl;
+    ASSERT_EQ(1 + 1, 3);
+}
+
+TEST("TimesOut", test::timeout(0.2)) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Every character either format has to escape, in the name, the failure and
+// the output
+TEST("Needs <escaping> & \"quotes\" 'too'") {
+    std::cout << "tab\there, <tag> & \"quote\"\nbackslash \\ and \x01" << std::endl;
+    ASSERT_TRUE(false && "</failure>");
+}
+
+END_TEST_FILE
@@ -0,0 +1,9 @@
+# The --json and --junit files for a pass, a failure, a timeout and a test
+# whose name and output need escaping. Times, and the directory the source
+# is in, are masked.
+./test --no-history -j 1 --no-stack-dump --json report.json \
+    --junit report.xml > /dev/null
+sed -E -e 's/"(wall|cpu)_ms": [0-9.]+/"\1_ms": T/g' \
+    -e 's#"file": "[^"]*/#"file": "#' report.json
+sed -E -e 's/time="[0-9.]+"/time="T"/g' -e 's#file="[^"]*/#file="#' report.xml
+rm -f report.json report.xml
@@ -0,0 +1,17 @@
+#include "../TestFramework.h"
+
+TEST_FILE
+
+TEST("Passes") {
+    ASSERT_TRUE(true);
+}
+
+TEST("AlsoPasses") {
+    ASSERT_EQ(2 + 2, 4);
+}
+
+TEST("Fails") {
+    ASSERT_EQ(2 + 2, 5);
+}
+
+END_TEST_FILE
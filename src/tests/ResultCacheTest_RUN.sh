@@ -0,0 +1,6 @@
+# One worker throughout, so the order tests run in is the order they're
+# listed. --failed-first has to move Fails ahead of AlsoPasses.
+./test --no-history -j 1
+./test --no-history -j 1 --only-failed
+./test --no-history -j 1 --failed-first
+./test --no-history -j 1 --skip-unchanged
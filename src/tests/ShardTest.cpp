@@ -0,0 +1,57 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+// Different lengths, so --shard-balance has something to balance
+TEST("Alpha") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(0));
+}
+
+TEST("Bravo") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(7));
+}
+
+TEST("Charlie") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(14));
+}
+
+TEST("Delta") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(21));
+}
+
+TEST("Echo") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(28));
+}
+
+TEST("Foxtrot") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+}
+
+TEST("Golf") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(12));
+}
+
+TEST("Hotel") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(19));
+}
+
+TEST("India") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(26));
+}
+
+TEST("Juliett") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(3));
+}
+
+TEST("Kilo") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+TEST("Lima") {
+    std::this_thread::sleep_for(std::chrono::milliseconds(17));
+}
+
+END_TEST_FILE
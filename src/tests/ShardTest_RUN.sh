@@ -0,0 +1,26 @@
+# Checks that 3 shards together have every test exactly once
+check() {
+    rm -f shards.txt
+    for index in 0 1 2; do
+        ./test --list --shard-count 3 --shard-index $index "$@" >> shards.txt
+    done
+    ./test --list | sort > all.txt
+    sort shards.txt > sorted.txt
+    if cmp -s all.txt sorted.txt; then
+        echo "shards partition the $(wc -l < all.txt) tests"
+    else
+        echo "shards don't partition the tests:"
+        diff all.txt sorted.txt
+    fi
+    rm -f shards.txt all.txt sorted.txt
+}
+
+# By a hash of the name, which is the same everywhere, so the shards themselves are shown
+for index in 0 1 2; do
+    echo "shard $index:" $(./test --list --shard-count 3 --shard-index $index)
+done
+check
+
+# By recorded duration, which changes from run to run
+./test > /dev/null
+check --shard-balance
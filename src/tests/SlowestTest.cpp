@@ -0,0 +1,28 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+static void sleepMs(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Named so that name order isn't duration order
+TEST("Instant") {
+}
+
+TEST("Medium") {
+    sleepMs(120);
+}
+
+TEST("Quick") {
+    sleepMs(40);
+}
+
+TEST("Slow") {
+    sleepMs(250);
+}
+
+END_TEST_FILE
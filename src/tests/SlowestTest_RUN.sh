@@ -0,0 +1,14 @@
+# Times change from run to run, so they're masked
+mask() {
+    sed -E 's/^ +[0-9.]+ ms wall +[0-9.]+ ms cpu +/    T ms wall T ms cpu  /'
+}
+
+# The first run has no history, so the tests go in name order. It leaves
+# the history in the directory it was run from.
+rm -f .testframework_history
+./test -j 1 --slowest 2 | mask
+cut -f 2 .testframework_history | sort
+
+# The second goes longest first, from that history
+./test -j 1 --slowest 2 | mask
+rm -f .testframework_history
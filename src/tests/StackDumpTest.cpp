@@ -0,0 +1,25 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+// Not inlined and not static, so with -rdynamic it's a named frame of its
+// own in the stack
+__attribute__((noinline)) void hangHere() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+TEST("Fast") {
+    ASSERT_EQ(1 + 1, 2);
+}
+
+TEST("PrintsThenHangs") {
+    std::cout << "about to hang" << std::endl;
+    hangHere();
+}
+
+END_TEST_FILE
@@ -0,0 +1,22 @@
+# Timeouts with the stuck thread's stack, in-process and then in an isolated
+# worker. Frames differ from build to build, so they're replaced by whether
+# one of them is hangHere().
+show() {
+    awk '
+    /^    #[0-9]+ / || /^[^ ].*\(.*\) ?\[0x[0-9a-f]+\]$/ {
+        if (/hangHere/) {
+            found = 1
+        }
+        next
+    }
+    {
+        if (found) {
+            print "    (stack includes hangHere)"
+            found = 0
+        }
+        print
+    }'
+}
+
+./test --no-history --timeout 0.2 -j 1 | show
+./test --no-history --isolate --timeout 0.2 -j 1 | show
@@ -0,0 +1,72 @@
+#include "../TestFramework.h"
+
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Scrapes --metrics-port from inside a test. The port is found by looking
+ * for the listening socket among the process's fds, which a child forked by
+ * --isolate inherits too.
+ */
+static int metricsPort() {
+    for (int fd = 3; fd < 1024; ++fd) {
+        int listening = 0;
+        socklen_t size = sizeof(listening);
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) == 0
+                && listening
+                && getsockname(fd, reinterpret_cast<sockaddr*>(&address),
+                    &length) == 0
+                && address.sin_family == AF_INET) {
+            return ntohs(address.sin_port);
+        }
+    }
+    return -1;
+}
+
+static std::string scrape(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    std::string response;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        const char request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        (void)!write(fd, request, sizeof(request) - 1);
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            response.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+    return response;
+}
+
+TEST_FILE
+
+TEST("APasses") {
+    ASSERT_EQ(2 + 2, 4);
+}
+
+TEST("Scrapes") {
+    const int port = metricsPort();
+    ASSERT_TRUE(port > 0);
+    const std::string response = scrape(port);
+    ASSERT_EQ(response.compare(0, 17, "HTTP/1.1 200 OK\r\n"), 0);
+    for (const char* line : {
+            "\ntestframework_tests 2\n",
+            "\ntestframework_runs_started_total 2\n",
+            "\ntestframework_runs_total{status=\"passed\"} 1\n",
+            "\ntestframework_runs_in_flight 1\n"}) {
+        ASSERT_TRUE(response.find(line) != std::string::npos, line + 1);
+    }
+}
+
+END_TEST_FILE
@@ -0,0 +1,5 @@
+# A test that scrapes --metrics-port 0 while it runs, in-process and then
+# from a child forked by --isolate (which the parent's thread answers). The
+# port that was picked is masked.
+./test --no-history -j 1 --metrics-port 0 | sed -E 's/127\.0\.0\.1:[0-9]+/127.0.0.1:PORT/'
+./test --no-history -j 1 --isolate --metrics-port 0 | sed -E 's/127\.0\.0\.1:[0-9]+/127.0.0.1:PORT/'
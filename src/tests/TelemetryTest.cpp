@@ -0,0 +1,28 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+TEST("Passes") {
+    std::cout << "twelve bytes";
+}
+
+TEST("Fails") {
+    ASSERT_EQ(1 + 1, 3);
+}
+
+TEST("AlsoPasses") {
+    ASSERT_EQ(2 + 2, 4);
+}
+
+// Slow the first time it runs in a process, and quick after that
+TEST("SlowOnce") {
+    static int runs = 0;
+    if (runs++ == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    }
+}
+
+END_TEST_FILE
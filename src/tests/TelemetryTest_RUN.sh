@@ -0,0 +1,19 @@
+# The final metrics file, in-process and then with --isolate. Bucket counts
+# and the duration sum depend on timing, so those are left out.
+show() {
+    grep -v '^#' metrics.prom | sed -E -e '/_bucket\{le="[0-9]/d' -e 's/_sum .*/_sum S/'
+}
+
+./test --repeat 2 --metrics-file metrics.prom --metrics-interval 0.05 -j 2 \
+    --exclude SlowOnce > /dev/null
+show
+./test --isolate --repeat 3 --metrics-file metrics.prom -j 2 \
+    --exclude SlowOnce > /dev/null
+show
+
+# Five runs in one worker process, one of them slow. Each run lands in its
+# own bucket, not all five in the one their average would.
+./test --isolate --repeat 5 --metrics-file metrics.prom -j 1 \
+    --filter SlowOnce > /dev/null
+grep -E '_bucket\{le="(0\.1|0\.5)"\}' metrics.prom
+rm -f metrics.prom
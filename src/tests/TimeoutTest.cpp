@@ -0,0 +1,36 @@
+#include "../TestFramework.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_FILE
+
+static void hang() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+TEST("Fast") {
+    ASSERT_EQ(1 + 1, 2);
+}
+
+TEST("Hangs") {
+    hang();
+}
+
+TEST("PrintsThenHangs") {
+    std::cout << "about to hang" << std::endl;
+    std::cerr << "still here" << std::endl;
+    hang();
+}
+
+TEST("RunsAfterTheHangs") {
+    ASSERT_TRUE(true);
+}
+
+TEST("SlowButAllowed", test::timeout(5)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+}
+
+END_TEST_FILE
@@ -0,0 +1,9 @@
+# In-process, where stuck threads are abandoned, and then in isolated
+# workers, which are killed. Either way a timeout fails the run, and a run
+# where everything passed doesn't.
+./test --no-history --timeout 0.2 --no-stack-dump -j 1
+echo "exit status $?"
+./test --no-history --isolate --timeout 0.2 --no-stack-dump -j 1
+echo "exit status $?"
+./test --no-history --timeout 0.2 --filter Fast > /dev/null
+echo "exit status $?"
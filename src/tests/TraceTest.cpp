@@ -0,0 +1,13 @@
+#include "../TestFramework.h"
+
+TEST_FILE
+
+TEST("Passes") {
+    ASSERT_EQ(2 + 2, 4);
+}
+
+TEST("Fails") {
+    ASSERT_EQ(1 + 1, 3);
+}
+
+END_TEST_FILE
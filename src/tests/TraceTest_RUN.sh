@@ -0,0 +1,60 @@
+# Every B has its E on the same thread, with nothing left open, and the
+# timestamps on each thread never go backwards. Prints the spans as
+# "thread: name (status)", the status only if it has one,
+# in the order they ended on each thread.
+check() {
+    awk '
+    function status(    s) {
+        s = field("status")
+        return s == "" ? "" : " (" s ")"
+    }
+    function field(name,    m) {
+        if (match($0, "\"" name "\": \"?[^\",}]*")) {
+            m = substr($0, RSTART, RLENGTH)
+            sub("^\"" name "\": \"?", "", m)
+            return m
+        }
+        return ""
+    }
+    /"ph": "M"/ && /"thread_name"/ {
+        threadName[field("tid")] = substr($0, index($0, "\"args\": {\"name\": \"") + 18)
+        sub(/".*/, "", threadName[field("tid")])
+        next
+    }
+    /"ph": "[BE]"/ {
+        tid = field("tid"); ts = field("ts") + 0; ph = field("ph")
+        if (tid in last && ts < last[tid]) {
+            print "time goes backwards on " threadName[tid]
+        }
+        last[tid] = ts
+        if (ph == "B") {
+            stack[tid, ++depth[tid]] = field("name")
+        } else if (depth[tid] == 0) {
+            print "E with no B on " threadName[tid]
+        } else {
+            name = stack[tid, depth[tid]--]
+            spans[++numSpans] = threadName[tid] ": " name status()
+        }
+    }
+    /"ph": "X"/ {
+        spans[++numSpans] = threadName[field("tid")] ": " field("name") status()
+    }
+    END {
+        for (tid in depth) {
+            if (depth[tid] > 0) {
+                print depth[tid] " spans left open on " threadName[tid]
+            }
+        }
+        for (i = 1; i <= numSpans; ++i) {
+            print spans[i]
+        }
+    }' trace.json | grep -v "^reporter: write" | sort -s -t: -k1,1 | sed -E "s/^worker [0-9]+:/worker:/"
+    tail -n 1 trace.json
+}
+
+# One worker, so the test order is fixed
+./test --no-history -j 1 --trace trace.json > /dev/null
+check
+./test --no-history --isolate -j 2 --trace trace.json > /dev/null
+check
+rm -f trace.json
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Times compiling a generated suite of test files (50 by default, 5 tests
+# each) against TestFramework.h, with and without its precompiled header.
+#
+#     bash compile_times.sh [NUM_FILES]
+
+NUM_FILES=${1:-50}
+SRC=$(cd .. && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+make -s -C "$SRC" || exit 1
+
+# The same headers without the .gch next to them
+mkdir "$WORK/nopch"
+ln -s "$SRC"/*.h "$WORK/nopch/"
+
+for i in $(seq 1 $NUM_FILES); do
+    FILE="$WORK/Suite${i}Test.cpp"
+    echo '#include "TestFramework.h"' > $FILE
+    echo '#include <string>' >> $FILE
+    echo '#include <vector>' >> $FILE
+    for t in 1 2 3 4 5; do
+        cat >> $FILE <<EOF
+
+TEST("Suite${i}Case${t}") {
+    std::vector<int> values{1, 2, 3};
+    ASSERT_EQ(values.size(), 3u);
+    ASSERT_TRUE(values[0] == 1, "first value");
+    std::string name = "case ${t}";
+    ASSERT_EQ(name, std::string("case ${t}"));
+    std::cout << name << std::endl;
+}
+EOF
+    done
+done
+
+compile_all() {
+    for f in "$WORK"/*.cpp; do
+        g++ -std=c++17 -I "$1" -c "$f" -o "${f%.cpp}.o" || exit 1
+    done
+}
+
+TIMEFORMAT="    %Rs"
+echo "Compiling $NUM_FILES files without the precompiled header:"
+time compile_all "$WORK/nopch"
+echo "Compiling $NUM_FILES files with the precompiled header:"
+time compile_all "$SRC"
+echo "Linking against libtestframework.a:"
+time g++ "$WORK"/*.o "$SRC/libtestframework.a" -pthread -o "$WORK/suite"
+
+"$WORK/suite" | tail -n 1
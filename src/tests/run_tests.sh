@@ -1,52 +1,17 @@
 #!/bin/sh
 
-
-TEST_NAMES="
-BasicTest
-DuplicateNameTest
-FailedAssertion
-PrintTest
-AssertTest
-"
-
-declare -i total=0
-declare -i pass=0
-declare -i fail=0
-declare -i bad_compile=0
-
-g++ -std=c++17 test_helpers/CompareOutput.cpp -o cmp
-
-for f in $TEST_NAMES
-do
-    echo "Processing $f.cpp..."
-    total=$((total + 1))
-    g++ $f.cpp -std=c++17
-    if [ $? -eq 0 ]; then
-        OUTPUT=$(bash -c '(./a.out)' 2>&1)
-        EXPECTED_OUTPUT=$(cat ${f}_EXPECTED.txt)
-
-        ./cmp "$EXPECTED_OUTPUT" "$OUTPUT"
-        if [ $? -eq 0 ]; then
-            echo "...OK"
-            pass=$((pass + 1))
-        else
-            fail=$((fail + 1))
-        fi
-    else
-        bad_compile=$((bad_compile + 1))
-    fi
-done
-
-
-echo 
-if [ $pass -eq $total ]; then
-    echo "All tests pass successfully!"
-else
-    echo "$pass of $total total tests pass."
-    if [ $fail -ne 0 ]; then
-        echo "    $fail tests produced the wrong output."
-    fi
-    if [ $bad_compile -ne 0 ]; then
-        echo "    $bad_compile tests failed to compile."
-    fi
-fi
+# Every <name>_EXPECTED.txt in this directory is a meta-test: <name>*.cpp is
+# linked with ../libtestframework.a, run with the flags in the optional
+# <name>_ARGS.txt (or by <name>_RUN.sh, if there is one), and its output
+# checked against the expected file. It's compiled with -std=c++17 unless
+# <name>_CXXFLAGS.txt says otherwise, and linked with the libraries listed in
+# <name>_LIBS.txt too. An expected file starting with a
+# %ORDERED% line is compared line for line; see test_helpers/CompareOutput.cpp.
+# Tests are compiled and run in parallel. Pass names to run only those, or
+# -j N to limit how many run at once.
+
+make -s -C .. || exit 1
+g++ -std=c++17 -O2 test_helpers/CompareOutput.cpp -o cmp || exit 1
+g++ -std=c++17 -O2 -pthread test_helpers/RunMetaTests.cpp -o run_meta_tests || exit 1
+
+./run_meta_tests "$@"
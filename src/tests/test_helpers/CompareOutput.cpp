@@ -1,61 +1,126 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <sstream>
-#include <vector>
+#include <stdexcept>
 #include <string>
-#include <algorithm>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "../../PrintHelpers.h"
 
-typedef std::unique_ptr<std::vector<std::string>> OutputPtr;
-OutputPtr getLines(char* inStr) {
-    auto lines = std::make_unique<std::vector<std::string>>();
-    std::stringstream current;
-    for (; *inStr != '\0'; inStr++) {
-        if (*inStr == '\n') {
-            lines->emplace_back(current.str());
-            current.str(std::string()); // clear
-            continue;
+/* Usage: cmp EXPECTED_FILE ACTUAL_FILE
+ *
+ * By default the expected output is a set of groups: each top-level line with
+ * the indented lines (or ------ block) under it. Groups can come in any
+ * order, since tests on several workers finish in any order, and a group
+ * only has to show up once.
+ *
+ * An expected file whose first line is %ORDERED% is instead compared line by
+ * line, in order, so every line has to be there exactly as many times as it
+ * is in the file. That's for output that's deterministic, where the order is
+ * the point (--failed-first, the events in a trace, and so on).
+ *
+ * Both files are memory mapped. The actual output is walked a line at a time
+ * straight out of the mapping, so a test can print many megabytes without
+ * any of it being copied. Only the expected output, which is small, gets
+ * parsed into groups up front.
+ */
+
+// A read only view of a whole file. Trailing newlines are dropped, the same
+// way $(...) in the shell drops them.
+class MappedFile {
+  public:
+    explicit MappedFile(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Couldn't open ") + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            size_ = info.st_size;
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error(std::string("Couldn't map ") + path);
+            }
+            data_ = static_cast<const char*>(data);
+            madvise(data, size_, MADV_SEQUENTIAL);
         }
-        current << *inStr;
+        close(fd);
     }
 
-    lines->push_back(std::move(current.str()));
-    return lines;
-}
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
 
-std::string build_string(std::initializer_list<std::string> in) {
-    std::stringstream out;
-    std::for_each(in.begin(), in.end(), [&out](std::string in) {
-        out << in;
-    });
+    std::string_view text() const {
+        std::string_view text(data_ ? data_ : "", size_);
+        while (!text.empty() && text.back() == '\n') {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
 
-    return out.str();
-}
+  private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
 
-// True for lines like "-----Test Output-----"
-bool isDashBlock(std::string& line) {
-    if (line.size() <= 4) {
-        return false;
+// Hands out one line at a time without copying
+class LineReader {
+  public:
+    explicit LineReader(std::string_view text) : text_(text) {
     }
-    for (size_t i = 0; i < 4; ++i) {
-        if (line[i] != '-') {
+
+    bool next(std::string_view& line) {
+        if (done_) {
             return false;
         }
+        size_t end = text_.find('\n', pos_);
+        if (end == std::string_view::npos) {
+            line = text_.substr(pos_);
+            done_ = true;
+        } else {
+            line = text_.substr(pos_, end - pos_);
+            pos_ = end + 1;
+        }
+        return true;
     }
 
-    return true;
+  private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    bool done_ = false;
+};
+
+// True for lines like "-----Test Output-----"
+bool isDashBlock(std::string_view line) {
+    return line.size() > 4 && line.compare(0, 4, "----") == 0;
 }
 
-std::string expandColor(std::string& in) {
-    if (in[in.size() - 1] != '%') {
-        return in;
+std::string expandColor(std::string_view in) {
+    if (in.empty() || in.back() != '%') {
+        return std::string(in);
     }
 
-    auto idx = in.find('%');
-    std::string color = in.substr(idx + 1, in.size() - idx - 2);
-    std::string line = in.substr(0, idx);
+    // From the end, since the line itself can have a % in it
+    auto idx = in.rfind('%', in.size() - 2);
+    if (idx == std::string_view::npos) {
+        return std::string(in);
+    }
+    std::string_view color = in.substr(idx + 1, in.size() - idx - 2);
+    std::string line(in.substr(0, idx));
 
     if (color == "RED") {
         return print::red(line);
@@ -77,53 +142,118 @@ std::string expandColor(std::string& in) {
     }
 
     // Shouldn't fall through but I'll leave this here in case
-    return in;
+    return std::string(in);
 }
 
-int exitAndPrint(std::string message, OutputPtr expected, OutputPtr actual) {
+// Past this many lines, outputs are cut short when they're printed
+const size_t maxPrintedLines = 200;
+
+void printLines(std::string_view text, bool expandColors) {
+    LineReader lines(text);
+    std::string_view line;
+    size_t printed = 0;
+    while (lines.next(line)) {
+        if (++printed > maxPrintedLines) {
+            std::cout << "    ... (" << text.size() << " bytes in total)"
+                << std::endl;
+            return;
+        }
+        std::cout << "    "
+            << (expandColors ? expandColor(line) : std::string(line))
+            << std::endl;
+    }
+}
+
+int exitAndPrint(
+        const std::string& message,
+        std::string_view expected,
+        std::string_view actual) {
     std::cout << message << std::endl << std::endl;
     std::cout << "Expected output:" << std::endl;
-    for (auto& line : *expected) {
-        std::cout << "    " << expandColor(line) << std::endl;
-    }
+    printLines(expected, true);
     std::cout << "\nActual output:" << std::endl;
-    for (const auto& line : *actual) {
-        std::cout << "    " << line << std::endl;
-    }
+    printLines(actual, false);
     std::cout << std::endl;
     return 1;
 }
 
+// The %ORDERED% comparison: every line, in order
+int compareOrdered(std::string_view expected, std::string_view actual) {
+    LineReader expectedLines(expected);
+    LineReader actualLines(actual);
+    std::string_view expectedLine;
+    std::string_view actualLine;
+    size_t lineNumber = 0;
+    while (expectedLines.next(expectedLine)) {
+        ++lineNumber;
+        const std::string want = expandColor(expectedLine);
+        if (!actualLines.next(actualLine)) {
+            return exitAndPrint("Output ended before expected line "
+                    + std::to_string(lineNumber) + ": \"" + want + "\"",
+                    expected, actual);
+        }
+        if (actualLine != want) {
+            return exitAndPrint("Line " + std::to_string(lineNumber)
+                    + " is \"" + std::string(actualLine) + "\"\n Expected: \""
+                    + want + "\"", expected, actual);
+        }
+    }
+    if (actualLines.next(actualLine)) {
+        return exitAndPrint("Got more output than expected, starting with \""
+                + std::string(actualLine) + "\"", expected, actual);
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
     if (argc != 3) {
-        throw std::runtime_error("Expected exactly 2 outputs to comapre");
+        std::cerr << "Usage: cmp EXPECTED_FILE ACTUAL_FILE" << std::endl;
+        return 2;
     }
 
-    // Seriailze both inputs into vectors of lines
-    auto expected = getLines(argv[1]);
-    auto actual = getLines(argv[2]);
+    MappedFile expectedFile(argv[1]);
+    MappedFile actualFile(argv[2]);
+    const std::string_view expected = expectedFile.text();
+    const std::string_view actual = actualFile.text();
+
+    const std::string_view orderedMarker = "%ORDERED%";
+    if (expected.substr(0, orderedMarker.size()) == orderedMarker
+            && (expected.size() == orderedMarker.size()
+                || expected[orderedMarker.size()] == '\n')) {
+        return compareOrdered(
+                expected.substr(std::min(expected.size(), orderedMarker.size() + 1)),
+                actual);
+    }
 
     // Parse the expected output into sets of groups of lines based on
-    // indentation. Map topLevel line --> indented lines
-    std::unordered_map<std::string, std::vector<std::string>> groups;
-    std::string topLevel = expected->at(0);
-    std::vector<std::string> indented;
-    for (size_t i = 1; i < expected->size(); ++i) {
-        std::string line = expected->at(i);
+    // indentation. Map topLevel line --> indented lines. The expanded lines
+    // live in storage, which never moves them, so the map can hold views.
+    std::deque<std::string> storage;
+    auto expand = [&storage](std::string_view line) {
+        return std::string_view(storage.emplace_back(expandColor(line)));
+    };
+    std::unordered_map<std::string_view, std::vector<std::string_view>> groups;
+    std::vector<std::string_view> topLevelOrder;
+
+    LineReader expectedLines(expected);
+    std::string_view line;
+    expectedLines.next(line);
+    std::string_view topLevel = expand(line);
+    std::vector<std::string_view> indented;
+    while (expectedLines.next(line)) {
         // Indented
-        if (line[0] == ' ') {
-            indented.push_back(expandColor(line));
+        if (!line.empty() && line[0] == ' ') {
+            indented.push_back(expand(line));
             continue;
         }
 
         // Need to treat ------ output blocks as indented lines
         if (isDashBlock(line)) {
-            indented.push_back(expandColor(line));
+            indented.push_back(expand(line));
 
             // Capture all lines until the next dash block
-            while (++i < expected->size()) {
-                line = expected->at(i);
-                indented.push_back(expandColor(line));
+            while (expectedLines.next(line)) {
+                indented.push_back(expand(line));
                 if (isDashBlock(line)) {
                     break;
                 }
@@ -135,71 +265,66 @@ int main(int argc, char** argv) {
         }
 
         // Otherwise we're ready to add a group and start the next one
-        groups.emplace(expandColor(topLevel), std::move(indented));
-        indented = std::vector<std::string>();
-        topLevel = line;
-    }
-    groups.emplace(expandColor(topLevel), std::move(indented));
-
-    size_t actualPtr = 0;
-    std::unordered_set<std::string> actualTopLevelLinesFound;
-    while (actualPtr < actual->size()) {
-        std::string& topLevel = actual->at(actualPtr);
-        actualTopLevelLinesFound.insert(topLevel);
-        if (!groups.count(topLevel)) {
+        if (groups.emplace(topLevel, std::move(indented)).second) {
+            topLevelOrder.push_back(topLevel);
+        }
+        indented = std::vector<std::string_view>();
+        topLevel = expand(line);
+    }
+    if (groups.emplace(topLevel, std::move(indented)).second) {
+        topLevelOrder.push_back(topLevel);
+    }
+
+    // Now stream through the actual output, matching each top level line and
+    // the group it starts
+    LineReader actualLines(actual);
+    std::unordered_set<std::string_view> actualTopLevelLinesFound;
+    std::string_view actualLine;
+    while (actualLines.next(actualLine)) {
+        const std::string_view actualTopLevel = actualLine;
+        actualTopLevelLinesFound.insert(actualTopLevel);
+        auto group = groups.find(actualTopLevel);
+        if (group == groups.end()) {
             return exitAndPrint(
-                    build_string({
-                        "Got unexpected line in output: \"",
-                        topLevel,
-                        "\""}),
-                    std::move(expected),
-                    std::move(actual));
+                    "Got unexpected line in output: \""
+                        + std::string(actualTopLevel) + "\"",
+                    expected,
+                    actual);
         }
-        const auto& indented = groups.at(topLevel);
-        for (size_t i = 0; i < indented.size(); ++i) {
-            if (actualPtr == actual->size() - 1) {
+        for (std::string_view expectedLine : group->second) {
+            if (!actualLines.next(actualLine)) {
                 return exitAndPrint(
-                        build_string({
-                            "Output ended before expected line: \"",
-                            indented.at(i),
-                            "\""}),
-                        std::move(expected),
-                        std::move(actual));
+                        "Output ended before expected line: \""
+                            + std::string(expectedLine) + "\"",
+                        expected,
+                        actual);
             }
-            if (indented.at(i) != actual->at(++actualPtr)) {
+            if (expectedLine != actualLine) {
                 return exitAndPrint(
-                        build_string({
-                            "Unexpected line: \"",
-                            actual->at(actualPtr),
-                            "\"\n    shortly after \"",
-                            topLevel,
-                            "\"\n Expected: \"",
-                            indented.at(i),
-                            "\""}),
-                        std::move(expected),
-                        std::move(actual));
+                        "Unexpected line: \"" + std::string(actualLine)
+                            + "\"\n    shortly after \""
+                            + std::string(actualTopLevel)
+                            + "\"\n Expected: \"" + std::string(expectedLine)
+                            + "\"",
+                        expected,
+                        actual);
             }
         }
-        ++actualPtr;
     }
 
     if (actualTopLevelLinesFound.size() < groups.size()) {
         std::stringstream message;
         message << "Didn't find the following expected lines in output:\n";
-        std::for_each(
-                groups.begin(),
-                groups.end(),
-                [&actualTopLevelLinesFound, &message](
-                        std::pair<std::string, std::vector<std::string>> pair) {
-            if (!actualTopLevelLinesFound.count(pair.first)) {
-                message << "    " << pair.first << std::endl;
-                for (const auto& line : pair.second) {
-                    message << "    " << line << std::endl;
+        for (std::string_view missing : topLevelOrder) {
+            if (!actualTopLevelLinesFound.count(missing)) {
+                message << "    " << missing << std::endl;
+                for (std::string_view indentedLine : groups.at(missing)) {
+                    message << "    " << indentedLine << std::endl;
                 }
             }
-        });
+        }
 
-        return exitAndPrint(message.str(), std::move(expected), std::move(actual));
+        return exitAndPrint(message.str(), expected, actual);
     }
 
     // Passed successfully
@@ -0,0 +1,244 @@
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Finds every meta-test (a <name>_EXPECTED.txt next to <name>*.cpp), then
+ * compiles and runs them in parallel, one per core by default.
+ *
+ *     run_meta_tests [-j N] [name...]
+ *
+ * Tests are compiled with -std=c++17, or the flags in <name>_CXXFLAGS.txt,
+ * and linked with any other libraries from ../ named in <name>_LIBS.txt.
+ * The binary is run as ./test with the flags in <name>_ARGS.txt, or, for a
+ * test that needs more than one run or has to pick the output apart, by the
+ * shell script <name>_RUN.sh instead. The script runs in the scratch
+ * directory with ./test next to it, and everything it prints is compared.
+ * Each test gets a scratch directory under .meta/<name>/ for its binary,
+ * output and history file, so concurrent tests never share a file. The
+ * output is checked with cmp, which must already be built next to this, and
+ * the tests link against ../libtestframework.a, which must be up to date.
+ */
+
+namespace fs = std::filesystem;
+
+struct MetaTest {
+    std::string name;
+    std::vector<fs::path> sources;
+    fs::path expected;
+    // Flags for the test binary, from the optional <name>_ARGS.txt
+    std::string args;
+    // Flags for g++, from the optional <name>_CXXFLAGS.txt
+    std::string cxxflags = "-std=c++17";
+    // Linked after libtestframework.a, from the optional <name>_LIBS.txt
+    std::vector<std::string> libs;
+    // Run instead of ./test ARGS, if there's a <name>_RUN.sh
+    fs::path script;
+};
+
+enum Outcome {
+    o_passed,
+    o_wrongOutput,
+    o_badCompile,
+};
+
+std::string readFile(const fs::path& path) {
+    std::ifstream in(path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+std::string quote(const fs::path& path) {
+    return "'" + path.string() + "'";
+}
+
+// Exit status of a shell command, or -1 if it didn't exit normally
+int runCommand(const std::string& command) {
+    int status = std::system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::vector<MetaTest> findTests(
+        const fs::path& dir, const std::vector<std::string>& only) {
+    const std::string suffix = "_EXPECTED.txt";
+    std::vector<MetaTest> tests;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        std::string file = entry.path().filename().string();
+        if (file.size() <= suffix.size()
+                || file.compare(file.size() - suffix.size(),
+                    suffix.size(), suffix) != 0) {
+            continue;
+        }
+
+        MetaTest test;
+        test.name = file.substr(0, file.size() - suffix.size());
+        if (!only.empty()
+                && std::find(only.begin(), only.end(), test.name) == only.end()) {
+            continue;
+        }
+        test.expected = entry.path();
+
+        // A test may be split across several files, e.g. MultiFileTestA.cpp
+        // and MultiFileTestB.cpp, which all link into one binary
+        for (const auto& source : fs::directory_iterator(dir)) {
+            std::string sourceName = source.path().filename().string();
+            if (sourceName.compare(0, test.name.size(), test.name) == 0
+                    && source.path().extension() == ".cpp") {
+                test.sources.push_back(source.path());
+            }
+        }
+        std::sort(test.sources.begin(), test.sources.end());
+
+        fs::path argsFile = dir / (test.name + "_ARGS.txt");
+        if (fs::exists(argsFile)) {
+            test.args = readFile(argsFile);
+            test.args.erase(test.args.find_last_not_of(" \n") + 1);
+        }
+        fs::path script = dir / (test.name + "_RUN.sh");
+        if (fs::exists(script)) {
+            test.script = script;
+        }
+        fs::path cxxflagsFile = dir / (test.name + "_CXXFLAGS.txt");
+        if (fs::exists(cxxflagsFile)) {
+            test.cxxflags = readFile(cxxflagsFile);
+            test.cxxflags.erase(test.cxxflags.find_last_not_of(" \n") + 1);
+        }
+        fs::path libsFile = dir / (test.name + "_LIBS.txt");
+        if (fs::exists(libsFile)) {
+            std::istringstream libs(readFile(libsFile));
+            std::string lib;
+            while (libs >> lib) {
+                test.libs.push_back(lib);
+            }
+        }
+        tests.push_back(std::move(test));
+    }
+
+    std::sort(tests.begin(), tests.end(),
+            [](const MetaTest& a, const MetaTest& b) {
+        return a.name < b.name;
+    });
+    return tests;
+}
+
+// Returns what happened, and anything worth showing in report
+Outcome runTest(const MetaTest& test, const fs::path& dir, std::string& report) {
+    const fs::path work = dir / ".meta" / test.name;
+    fs::create_directories(work);
+    const fs::path binary = work / "test";
+    const fs::path output = work / "output.txt";
+    const fs::path compileLog = work / "compile.txt";
+    const fs::path cmpLog = work / "cmp.txt";
+
+    std::string compile = "g++ " + test.cxxflags;
+    for (const auto& source : test.sources) {
+        compile += " " + quote(source);
+    }
+    compile += " " + quote(dir.parent_path() / "libtestframework.a");
+    for (const auto& lib : test.libs) {
+        compile += " " + quote(dir.parent_path() / lib);
+    }
+    compile += " -pthread -o " + quote(binary) + " > " + quote(compileLog) + " 2>&1";
+    if (runCommand(compile) != 0) {
+        report = readFile(compileLog);
+        return o_badCompile;
+    }
+
+    // Run from the scratch directory so the history file stays private
+    const std::string run = test.script.empty() ? "./test " + test.args
+        : "sh " + quote(test.script);
+    runCommand("cd " + quote(work) + " && (" + run + ") > "
+            + quote(output) + " 2>&1");
+
+    if (runCommand(quote(dir / "cmp") + " " + quote(test.expected) + " "
+                + quote(output) + " > " + quote(cmpLog) + " 2>&1") != 0) {
+        report = readFile(cmpLog);
+        return o_wrongOutput;
+    }
+    return o_passed;
+}
+
+int main(int argc, char** argv) {
+    size_t numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> only;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            numWorkers = std::max(1, std::atoi(argv[++i]));
+        } else {
+            only.push_back(arg);
+        }
+    }
+
+    const fs::path dir = fs::current_path();
+    const std::vector<MetaTest> tests = findTests(dir, only);
+    auto start = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> pass{0};
+    std::atomic<size_t> fail{0};
+    std::atomic<size_t> badCompile{0};
+    std::mutex printMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < tests.size(); i = next++) {
+            std::string report;
+            Outcome outcome = runTest(tests[i], dir, report);
+
+            std::lock_guard lg(printMutex);
+            switch (outcome) {
+                case o_passed:
+                    ++pass;
+                    std::cout << tests[i].name << "...OK" << std::endl;
+                    break;
+                case o_wrongOutput:
+                    ++fail;
+                    std::cout << tests[i].name << "...wrong output" << std::endl
+                        << report << std::endl;
+                    break;
+                case o_badCompile:
+                    ++badCompile;
+                    std::cout << tests[i].name << "...failed to compile"
+                        << std::endl << report << std::endl;
+                    break;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(numWorkers, tests.size()); ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    std::cout << std::endl << "Ran " << tests.size() << " tests in "
+        << std::fixed << std::setprecision(1) << seconds << "s" << std::endl;
+    if (pass == tests.size()) {
+        std::cout << "All tests pass successfully!";
+    } else {
+        std::cout << pass << " of " << tests.size() << " total tests pass.";
+        if (fail != 0) {
+            std::cout << "\n    " << fail << " tests produced the wrong output.";
+        }
+        if (badCompile != 0) {
+            std::cout << "\n    " << badCompile << " tests failed to compile.";
+        }
+    }
+    std::cout << std::endl;
+    return pass == tests.size() ? 0 : 1;
+}